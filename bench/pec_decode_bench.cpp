@@ -0,0 +1,309 @@
+/*
+ * Microbenchmark of the PEC stitch decoder.
+ *
+ * Checks first that the batch decoder returns the same records and bounds
+ * as the one record at a time decoder, on random streams and on streams
+ * with a long, color change or end record at every position of a 16 byte
+ * window, cut off at every length. Then decodes the same design over and
+ * over with both decoders and with the whole parse_pes, and reports the
+ * best throughput in GB/s of stitch data.
+ */
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <cxxopts.hpp>
+#include <fmt/core.h>
+
+#include "pes.h"
+#include "synthetic_pes.h"
+
+using clock_type = std::chrono::steady_clock;
+
+// Best time of `repeat` runs of `f` in seconds.
+template <typename F>
+static double best_of(int repeat, F f)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeat; i++)
+    {
+        auto start = clock_type::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(clock_type::now() - start).count());
+    }
+    return best;
+}
+
+// What a decoder returned: every record in order, color changes and the
+// end as x = 0, y = 0 and flags -1 and -2, and the bounds of the stitches.
+struct decoded {
+    std::vector<std::array<int, 4>> records;
+    pes bounds;
+
+    void add(pec_decoder::result r, const stitch &s)
+    {
+        if (r == pec_decoder::stitch_record)
+        {
+            records.push_back({s.x, s.y, s.jumpstitch, s.speed});
+            bounds.min_x = std::min(bounds.min_x, s.x);
+            bounds.max_x = std::max(bounds.max_x, s.x);
+            bounds.min_y = std::min(bounds.min_y, s.y);
+            bounds.max_y = std::max(bounds.max_y, s.y);
+        }
+        else
+        {
+            records.push_back({0, 0, r == pec_decoder::color_change ? -1 : -2, 0});
+        }
+    }
+
+    bool operator==(const decoded &o) const
+    {
+        return records == o.records && bounds.min_x == o.bounds.min_x && bounds.max_x == o.bounds.max_x &&
+               bounds.min_y == o.bounds.min_y && bounds.max_y == o.bounds.max_y;
+    }
+};
+
+static decoded decode_scalar(const std::vector<unsigned char> &bytes)
+{
+    pec_decoder decoder(bytes.data(), bytes.data() + bytes.size());
+    decoded result;
+    stitch s;
+    pec_decoder::result r;
+    do
+    {
+        r = decoder.next(s);
+        result.add(r, s);
+    } while (r != pec_decoder::end);
+    return result;
+}
+
+// Like parse_pes: batches of up to `max`, next where the batch stops.
+static decoded decode_batch(const std::vector<unsigned char> &bytes, std::size_t max)
+{
+    pec_decoder decoder(bytes.data(), bytes.data() + bytes.size());
+    decoded result;
+    std::vector<stitch> run(max);
+    stitch s;
+    pec_decoder::result r;
+    do
+    {
+        pes batch_bounds = result.bounds;
+        auto n = decoder.next_stitches(run.data(), max, batch_bounds);
+        for (std::size_t i = 0; i < n; i++)
+            result.add(pec_decoder::stitch_record, run[i]);
+        // The bounds next_stitches widened have to be the ones of its stitches
+        if (batch_bounds.min_x != result.bounds.min_x || batch_bounds.max_x != result.bounds.max_x ||
+            batch_bounds.min_y != result.bounds.min_y || batch_bounds.max_y != result.bounds.max_y)
+            result.records.push_back({0, 0, -3, 0});
+        if (n > 0)
+            continue;
+        r = decoder.next(s);
+        result.add(r, s);
+    } while (r != pec_decoder::end);
+    return result;
+}
+
+static void short_record(std::vector<unsigned char> &out, int dx, int dy)
+{
+    out.push_back(dx & 0x7f);
+    out.push_back(dy & 0x7f);
+}
+
+// A record with a long form x, a long form y or both, `flags` in the
+// first long form byte.
+static void long_record(std::vector<unsigned char> &out, int dx, int dy, int which, int flags)
+{
+    for (int axis = 0; axis < 2; axis++)
+    {
+        int d = axis ? dy : dx;
+        if (which & (1 << axis))
+        {
+            out.push_back(0x80 | flags | ((d >> 8) & 15));
+            out.push_back(d & 0xff);
+        }
+        else
+        {
+            out.push_back(std::clamp(d, -64, 63) & 0x7f);
+        }
+    }
+}
+
+// Streams with every kind of record at every offset of a 16 byte window,
+// behind a run of short records that is long enough for the SSE2 path.
+static std::vector<std::vector<unsigned char>> edge_streams()
+{
+    std::vector<std::vector<unsigned char>> streams;
+    for (int shift = 0; shift < 2; shift++)
+    {
+        for (int shorts = 0; shorts <= 16; shorts++)
+        {
+            for (int kind = 0; kind < 9; kind++)
+            {
+                std::vector<unsigned char> s;
+                // A three byte record first moves the window by one byte
+                if (shift)
+                    long_record(s, 300, 5, 1, 0);
+                for (int i = 0; i < shorts; i++)
+                    short_record(s, i % 2 ? -64 : 63, i % 3 ? 17 : -33);
+                if (kind < 6)
+                    long_record(s, kind % 2 ? -2048 : 2047, kind % 2 ? 2047 : -2048, 1 + kind % 3, kind < 3 ? 0 : 0x10 << (kind % 2));
+                else if (kind == 6)
+                    s.insert(s.end(), {0xfe, 0xb0, 0x02});
+                else if (kind == 7)
+                    s.insert(s.end(), {0xff, 0x00});
+                for (int i = 0; i < 24; i++)
+                    short_record(s, -i, i);
+                if (kind == 8)
+                    s.insert(s.end(), {0xff, 0x00});
+                streams.push_back(s);
+            }
+        }
+    }
+    return streams;
+}
+
+static std::vector<unsigned char> random_stream(std::mt19937 &rng)
+{
+    std::vector<unsigned char> s;
+    std::uniform_int_distribution<int> kind(0, 99), delta(-64, 63), long_delta(-2048, 2047), run(1, 40);
+    for (int records = run(rng) * 10; records > 0; records--)
+    {
+        auto k = kind(rng);
+        if (k < 70)
+        {
+            for (int i = run(rng); i > 0; i--)
+                short_record(s, delta(rng), delta(rng));
+        }
+        else if (k < 95)
+            long_record(s, long_delta(rng), long_delta(rng), 1 + k % 3, (k % 4) * 0x10 & 0x30);
+        else if (k < 99)
+            s.insert(s.end(), {0xfe, 0xb0, (unsigned char)k});
+        else
+            s.insert(s.end(), {0xff, 0x00});
+    }
+    return s;
+}
+
+// Returns the number of streams the batch decoder decoded differently.
+static std::size_t check_batch_decoder(std::size_t &checked)
+{
+    std::size_t mismatched = 0;
+    auto check = [&](const std::vector<unsigned char> &bytes) {
+        auto expected = decode_scalar(bytes);
+        for (std::size_t max : {1, 2, 7, 8, 9, 16, 256})
+        {
+            checked++;
+            if (!(decode_batch(bytes, max) == expected))
+                mismatched++;
+        }
+    };
+
+    // Cut off at every length, so records are truncated everywhere
+    for (auto &stream : edge_streams())
+    {
+        for (std::size_t size = 0; size <= stream.size(); size++)
+            check(std::vector<unsigned char>(stream.begin(), stream.begin() + size));
+    }
+    std::mt19937 rng(11);
+    for (int i = 0; i < 500; i++)
+    {
+        auto stream = random_stream(rng);
+        check(stream);
+        check(std::vector<unsigned char>(stream.begin(), stream.begin() + stream.size() * (i % 7) / 7));
+    }
+    return mismatched;
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("pec_decode_bench", "Measures the throughput of the PEC stitch decoder");
+    try
+    {
+        options.add_options()
+            ("f,file", "decode this pes file instead of a synthetic design", cxxopts::value<std::string>())
+            ("stitches", "stitches of the synthetic design", cxxopts::value<int>()->default_value("1000000"))
+            ("r,repeat", "runs of every decoder, the best one counts", cxxopts::value<int>()->default_value("20"));
+
+        auto result = options.parse(argc, argv);
+        auto repeat = result["repeat"].as<int>();
+
+        std::size_t checked = 0;
+        auto mismatched = check_batch_decoder(checked);
+        fmt::print("{} streams checked, {} decoded differently by next_stitches\n", checked, mismatched);
+        if (mismatched)
+            return 1;
+
+        std::vector<unsigned char> pes_bin;
+        if (result.count("file"))
+        {
+            mapped_file file(result["file"].as<std::string>());
+            auto bytes = file.bytes();
+            pes_bin.assign(bytes.data, bytes.data + bytes.size);
+        }
+        else
+        {
+            pes_bin = synthetic_pes(result["stitches"].as<int>());
+        }
+
+        pes reference = parse_pes(pes_bin);
+        std::size_t stitches = 0;
+        for (auto &block : reference.blocks)
+            stitches += block.stitches.size();
+        // Everything behind the PEC header is stitch data.
+        auto pec = *reinterpret_cast<const unsigned int *>(pes_bin.data() + 8);
+        double stream_bytes = pes_bin.size() - pec - 532;
+
+        long checksum = 0;
+        auto scalar = best_of(repeat, [&] {
+            auto decoder = pec_stitches(pes_bin);
+            int min_x = std::numeric_limits<int>::max(), max_x = std::numeric_limits<int>::min();
+            int min_y = min_x, max_y = max_x;
+            stitch s;
+            pec_decoder::result r;
+            while ((r = decoder.next(s)) != pec_decoder::end)
+            {
+                if (r != pec_decoder::stitch_record)
+                    continue;
+                min_x = std::min(min_x, s.x);
+                max_x = std::max(max_x, s.x);
+                min_y = std::min(min_y, s.y);
+                max_y = std::max(max_y, s.y);
+            }
+            checksum += min_x + max_x + min_y + max_y;
+        });
+
+        auto batch = best_of(repeat, [&] {
+            pes bounds = parse_pes_header(pes_bin);
+            checksum += bounds.min_x + bounds.max_x + bounds.min_y + bounds.max_y;
+        });
+
+        auto full = best_of(repeat, [&] {
+            pes pattern = parse_pes(pes_bin);
+            checksum += pattern.blocks.size();
+        });
+
+        fmt::print("{} stitches, {:.2f} MB of stitch data, checksum {}\n", stitches, stream_bytes / 1e6, checksum);
+        fmt::print("{:<28} {:>10} {:>14}\n", "decoder", "GB/s", "Mstitches/s");
+        for (auto [name, seconds] : {std::pair<const char *, double>{"next, one record at a time", scalar},
+                                     {"next_stitches (bounds only)", batch},
+                                     {"parse_pes", full}})
+        {
+            fmt::print("{:<28} {:>10.2f} {:>14.1f}\n", name, stream_bytes / seconds / 1e9, stitches / seconds / 1e6);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << "\n"
+                  << options.help();
+        return -1;
+    }
+    catch (const char *e)
+    {
+        std::cout << e << "\n";
+        return -1;
+    }
+    return 0;
+}
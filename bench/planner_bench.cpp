@@ -0,0 +1,171 @@
+/*
+ * Microbenchmark of the speed planner.
+ *
+ * Plans a synthetic design with calc_speed, using the hoop model, and with
+ * the per jump ramp loops it replaced, checks that calc_speed is never faster than them and
+ * that speed_planner plans the same as calc_speed, and reports the best
+ * time of each. --jump-every marks additional jump stitches to get the
+ * dense jump regions where the ramps overlap.
+ */
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <cxxopts.hpp>
+#include <fmt/core.h>
+
+#include "pes.h"
+#include "planner.h"
+#include "synthetic_pes.h"
+
+using clock_type = std::chrono::steady_clock;
+
+// Best time of `repeat` runs of `f` in seconds.
+template <typename F>
+static double best_of(int repeat, F f)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeat; i++)
+    {
+        auto start = clock_type::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(clock_type::now() - start).count());
+    }
+    return best;
+}
+
+// calc_speed as it was when only jump stitches were slow: a ramp down
+// before and a ramp up after every one of them.
+static void legacy_calc_speed(pes &pattern)
+{
+    for (auto &block : pattern.blocks)
+    {
+        for (std::size_t idx = 0; idx < block.stitches.size(); ++idx)
+            block.stitches.set_speed(idx, max_speed);
+    }
+    for (auto &block : pattern.blocks)
+    {
+        auto &stitches = block.stitches;
+        for (int idx = 0; idx < int(stitches.size()); ++idx)
+        {
+            if (idx == 0 || idx == int(stitches.size()) - 1)
+                stitches.set_jump(idx, true);
+            if (!stitches.jump(idx))
+                continue;
+
+            stitches.set_speed(idx, speed_ramp_step);
+            int previous_speed = stitches.speed(idx);
+            for (int idx_reverse = idx - 1; idx_reverse >= 0; --idx_reverse)
+            {
+                int val = std::min(max_speed, previous_speed + speed_ramp_step);
+                if (stitches.speed(idx_reverse) > val)
+                    stitches.set_speed(idx_reverse, val);
+                else
+                    break;
+                if (val == max_speed)
+                    break;
+                previous_speed = val;
+            }
+
+            previous_speed = stitches.speed(idx);
+            for (int idx_forward = idx + 1; idx_forward < int(stitches.size()); idx_forward++)
+            {
+                int val = std::min(max_speed, previous_speed + speed_ramp_step);
+                stitches.set_speed(idx_forward, val);
+                if (val == max_speed)
+                    break;
+                previous_speed = val;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("planner_bench", "Measures the speed planner");
+    try
+    {
+        options.add_options()
+            ("stitches", "stitches of the synthetic design", cxxopts::value<int>()->default_value("1000000"))
+            ("jump-every", "also make on average every n-th stitch a jump stitch, 0 for none",
+             cxxopts::value<int>()->default_value("0"))
+            ("r,repeat", "runs of every planner, the best one counts", cxxopts::value<int>()->default_value("20"));
+
+        auto result = options.parse(argc, argv);
+        auto repeat = result["repeat"].as<int>();
+        auto jump_every = result["jump-every"].as<int>();
+
+        pes pattern = parse_pes(synthetic_pes(result["stitches"].as<int>()));
+        std::size_t stitches = 0;
+        std::uint32_t seed = 7;
+        for (auto &block : pattern.blocks)
+        {
+            stitches += block.stitches.size();
+            for (std::size_t i = 0; jump_every > 0 && i < block.stitches.size(); i++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                if ((seed >> 8) % unsigned(jump_every) == 0)
+                    block.stitches.set_jump(i, true);
+            }
+        }
+
+        pes legacy = pattern;
+        auto legacy_seconds = best_of(repeat, [&] { legacy_calc_speed(legacy); });
+        pes planned = pattern;
+        auto seconds = best_of(repeat, [&] { calc_speed(planned, true); });
+
+        std::vector<stitch> streamed;
+        streamed.reserve(stitches);
+        auto streamed_seconds = best_of(repeat, [&] {
+            streamed.clear();
+            speed_planner planner(true);
+            stitch s;
+            for (auto &block : pattern.blocks)
+            {
+                for (auto st : block.stitches)
+                {
+                    planner.push(st);
+                    while (planner.pop(s))
+                        streamed.push_back(s);
+                }
+                planner.end_block();
+                while (planner.pop(s))
+                    streamed.push_back(s);
+            }
+        });
+
+        std::size_t slowed = 0, faster = 0, mismatched = 0, idx = 0;
+        for (std::size_t b = 0; b < pattern.blocks.size(); b++)
+        {
+            auto &a = legacy.blocks[b].stitches;
+            auto &c = planned.blocks[b].stitches;
+            for (std::size_t i = 0; i < a.size(); i++, idx++)
+            {
+                slowed += c.speed(i) < a.speed(i);
+                faster += c.speed(i) > a.speed(i) || a.jump(i) != c.jump(i);
+                mismatched += streamed[idx].speed != c.speed(i) || streamed[idx].jumpstitch != c.jump(i);
+            }
+        }
+
+        fmt::print("{} stitches, {} slowed for their length, {} faster than the ramp loops, "
+                   "{} streamed differently\n", stitches, slowed, faster, mismatched);
+        fmt::print("{:<14} {:>10} {:>14}\n", "planner", "ms", "Mstitches/s");
+        for (auto [name, s] : {std::pair<const char *, double>{"ramp loops", legacy_seconds},
+                               {"calc_speed", seconds},
+                               {"speed_planner", streamed_seconds}})
+            fmt::print("{:<14} {:>10.2f} {:>14.1f}\n", name, s * 1e3, stitches / s / 1e6);
+        return faster || mismatched ? 1 : 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << "\n"
+                  << options.help();
+        return -1;
+    }
+    catch (const char *e)
+    {
+        std::cout << e << "\n";
+        return -1;
+    }
+}
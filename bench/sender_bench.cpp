@@ -0,0 +1,394 @@
+/*
+ * End-to-end benchmark of the sender.
+ *
+ * Runs mapped_file -> parse_pes -> calc_speed -> send against the firmware
+ * emulator on a pseudo-terminal. The emulator runs in a child process, so
+ * CPU time and syscalls measured here belong to the sender alone.
+ */
+#include <dlfcn.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <system_error>
+
+#include <cxxopts.hpp>
+#include <fmt/core.h>
+
+#include "duplex_sender.h"
+#include "emulator.h"
+#include "job.h"
+#include "pes.h"
+#include "planner.h"
+#include "sender.h"
+#include "synthetic_pes.h"
+
+using clock_type = std::chrono::steady_clock;
+
+// A way of sending the job. "baseline" is the sender as it was before the
+// command window, see legacy_send_one, "ascii-w1" is command_sender doing
+// the same stop-and-wait exchange.
+struct bench_mode {
+    std::string name;
+    bool ascii_only;
+    int window;
+    int stitches_per_frame;
+    bool duplex;
+    bool legacy;
+};
+
+static const bench_mode all_modes[] = {
+    {"baseline", true, 1, 1, false, true},
+    {"ascii-w1", true, 1, 1, false, false},
+    {"ascii-w4", true, 4, 1, false, false},
+    {"binary-w4", false, 4, 1, false, false},
+    {"stitch-k8-w4", false, 4, 8, false, false},
+    {"duplex-ascii-w4", true, 4, 1, true, false},
+    {"duplex-k8-w4", false, 4, 8, true, false},
+};
+
+struct bench_result {
+    std::string mode;
+    int stitches;
+    int latency_us;
+    double seconds;
+    double stitches_per_second;
+    double p50_us, p99_us, p999_us;
+    double syscalls_per_stitch;
+    double cpu_seconds;
+};
+
+// Number of syscalls the sender made so far. /proc/self/io only counts
+// read and write, but the senders differ just as much in the ioctl, tcdrain
+// and wait calls around them. The serial library is linked into this
+// binary, so the libc wrappers it calls are defined below, counted and
+// passed on to libc.
+static std::atomic<long> syscall_count{0};
+
+static long syscalls()
+{
+    return syscall_count.load();
+}
+
+template <typename F>
+static F libc_function(const char *name)
+{
+    auto f = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+    if (!f)
+        abort();
+    return f;
+}
+
+extern "C" {
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    static auto next = libc_function<ssize_t (*)(int, void *, size_t)>("read");
+    syscall_count++;
+    return next(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    static auto next = libc_function<ssize_t (*)(int, const void *, size_t)>("write");
+    syscall_count++;
+    return next(fd, buf, count);
+}
+
+int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    static auto next = libc_function<int (*)(int, unsigned long, void *)>("ioctl");
+    va_list ap;
+    va_start(ap, request);
+    auto arg = va_arg(ap, void *);
+    va_end(ap);
+    syscall_count++;
+    return next(fd, request, arg);
+}
+
+int tcdrain(int fd)
+{
+    static auto next = libc_function<int (*)(int)>("tcdrain");
+    syscall_count++;
+    return next(fd);
+}
+
+int poll(pollfd *fds, nfds_t nfds, int timeout)
+{
+    static auto next = libc_function<int (*)(pollfd *, nfds_t, int)>("poll");
+    syscall_count++;
+    return next(fds, nfds, timeout);
+}
+
+int pselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, const timespec *timeout, const sigset_t *sigmask)
+{
+    static auto next = libc_function<int (*)(int, fd_set *, fd_set *, fd_set *, const timespec *, const sigset_t *)>("pselect");
+    syscall_count++;
+    return next(nfds, readfds, writefds, exceptfds, timeout, sigmask);
+}
+
+int epoll_wait(int epfd, epoll_event *events, int maxevents, int timeout)
+{
+    static auto next = libc_function<int (*)(int, epoll_event *, int, int)>("epoll_wait");
+    syscall_count++;
+    return next(epfd, events, maxevents, timeout);
+}
+}
+
+static double cpu_seconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static double percentile_us(std::vector<clock_type::duration> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    auto idx = std::min(sorted.size() - 1, std::size_t(p * sorted.size()));
+    return std::chrono::duration<double, std::micro>(sorted[idx]).count();
+}
+
+// The sender as it was before the command window: one command at a time,
+// written, drained with tcdrain and its reply awaited by polling
+// available() in a busy loop. Only the printing of every command and
+// reply is left out.
+static void legacy_send_one(serial::Serial &ser, const stitch &s, int mot, float x_offset, float y_offset,
+                            std::vector<clock_type::duration> &latencies)
+{
+    auto cmmd = fmt::format(">m{};{};{};{};", (x_offset + s.x) / 10, (y_offset + s.y) / 10, int(mot), s.speed);
+    auto sent = clock_type::now();
+    ser.write(cmmd);
+    ser.flush();
+    while (ser.available() < 1)
+    {
+    }
+    auto x = ser.read();
+    if (x[0] == '!')
+    {
+        while (ser.available() < 1)
+        {
+        }
+        x = ser.read();
+    }
+    latencies.push_back(clock_type::now() - sent);
+}
+
+static void legacy_send(serial::Serial &ser, const pes &pattern, std::vector<clock_type::duration> &latencies)
+{
+    // The old sender slept for a second after ">e", that is left out too.
+    ser.write(">e");
+    while (ser.available() < 1)
+    {
+    }
+    ser.read();
+
+    float x_offset = 0.0, y_offset = 0.0;
+    if (pattern.min_x < 0)
+        x_offset = -pattern.min_x;
+    if (pattern.min_y < 0)
+        y_offset = -pattern.min_y;
+    for (auto &block : pattern.blocks)
+    {
+        for (stitch s : block.stitches)
+        {
+            if (s.jumpstitch == 0)
+            {
+                legacy_send_one(ser, s, ticks_hoop_moving, x_offset, y_offset, latencies);
+                legacy_send_one(ser, s, ticks_hoop_not_moving, x_offset, y_offset, latencies);
+            }
+            else
+            {
+                legacy_send_one(ser, s, 0, x_offset, y_offset, latencies);
+                legacy_send_one(ser, s, ticks_per_stitch, x_offset, y_offset, latencies);
+            }
+        }
+    }
+
+    ser.write(">d");
+    while (ser.available() < 1)
+    {
+    }
+    ser.read();
+}
+
+static bench_result run(const std::string &file, int stitches, int latency_us, const bench_mode &mode)
+{
+    emulator_config config;
+    config.ticks_per_second_per_speed = 0;
+    config.ack_latency = std::chrono::microseconds(latency_us);
+    config.rx_buffer = 1024;
+    config.binary_frames = config.stitch_frames = !mode.ascii_only;
+
+    int master, slave;
+    char name[100];
+    termios tio{};
+    cfmakeraw(&tio);
+    if (openpty(&master, &slave, name, &tio, nullptr) == -1)
+        throw std::system_error(errno, std::generic_category(), "openpty");
+
+    auto child = fork();
+    if (child == -1)
+        throw std::system_error(errno, std::generic_category(), "fork");
+    if (child == 0)
+    {
+        // The slave stays open until the job is done, otherwise the emulator
+        // would see a hangup before the sender opened the port. Afterwards
+        // the master has to stay open until the sender closed the port, or
+        // the sender loses the last reply.
+        firmware_emulator emulator(config);
+        bool ok = emulator.run(master);
+        ::close(slave);
+        pollfd pfd{master, 0, 0};
+        while (ok && poll(&pfd, 1, -1) >= 0 && !(pfd.revents & POLLHUP))
+        {
+        }
+        _exit(ok ? 0 : 1);
+    }
+    ::close(master);
+    struct child_guard {
+        pid_t pid;
+        ~child_guard()
+        {
+            if (pid > 0)
+                kill(pid, SIGKILL);
+        }
+    } guard{child};
+
+    bench_result res{mode.name, stitches, latency_us, 0, 0, 0, 0, 0, 0, 0};
+    std::vector<clock_type::duration> latencies;
+    latencies.reserve(2 * stitches + 16);
+    {
+        serial::Serial ser(name, 115200);
+        ::close(slave);
+        command_sender sender(ser, mode.window, 10000);
+        sender.record_latencies(&latencies);
+
+        auto syscalls_before = syscalls();
+        auto cpu = cpu_seconds();
+        auto start = clock_type::now();
+
+        pes pattern;
+        {
+            mapped_file mapped(file);
+            pattern = parse_pes(mapped);
+        }
+        calc_speed(pattern);
+
+        if (mode.legacy)
+            legacy_send(ser, pattern, latencies);
+        else
+        {
+            ser.write(">e");
+            auto format = negotiate_format(sender.read_reply(), mode.ascii_only, mode.stitches_per_frame);
+            {
+                std::unique_ptr<duplex_sender> duplex;
+                if (mode.duplex)
+                {
+                    duplex = std::make_unique<duplex_sender>(ser, mode.window, 10000);
+                    duplex->record_latencies(&latencies);
+                }
+                command_link &link = duplex ? static_cast<command_link &>(*duplex) : sender;
+                job_sender job(link, format, pattern);
+                for (std::size_t b = 0; b < pattern.blocks.size(); b++)
+                    job.send_block(b);
+            }
+            ser.write(">d");
+            sender.read_reply();
+        }
+
+        res.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+        res.cpu_seconds = cpu_seconds() - cpu;
+        res.syscalls_per_stitch = double(syscalls() - syscalls_before) / stitches;
+    }
+    int status;
+    waitpid(child, &status, 0);
+    guard.pid = 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("emulator failed");
+
+    std::sort(latencies.begin(), latencies.end());
+    res.stitches_per_second = stitches / res.seconds;
+    res.p50_us = percentile_us(latencies, 0.5);
+    res.p99_us = percentile_us(latencies, 0.99);
+    res.p999_us = percentile_us(latencies, 0.999);
+    return res;
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("sender_bench", "Measures the sender against the firmware emulator");
+    try
+    {
+        options.add_options()
+            ("sizes", "stitches per pattern", cxxopts::value<std::vector<int>>()->default_value("1000,10000"))
+            ("latencies", "emulated ack latency in microseconds", cxxopts::value<std::vector<int>>()->default_value("0,250,1000"))
+            ("modes", "baseline, ascii-w1, ascii-w4, binary-w4, stitch-k8-w4, duplex-ascii-w4, duplex-k8-w4", cxxopts::value<std::vector<std::string>>()->default_value("baseline,ascii-w1,ascii-w4,binary-w4,stitch-k8-w4,duplex-ascii-w4,duplex-k8-w4"))
+            ("o,output", "write the results as JSON to this file", cxxopts::value<std::string>());
+
+        auto result = options.parse(argc, argv);
+        auto modes = result["modes"].as<std::vector<std::string>>();
+
+        std::vector<bench_result> results;
+        fmt::print("{:<16} {:>8} {:>8} {:>12} {:>9} {:>9} {:>9} {:>10} {:>8}\n",
+                   "mode", "stitches", "lat_us", "stitches/s", "p50_us", "p99_us", "p999_us", "sys/stitch", "cpu_s");
+        for (auto stitches : result["sizes"].as<std::vector<int>>())
+        {
+            auto file = fmt::format("/tmp/sender_bench_{}_{}.pes", getpid(), stitches);
+            auto pes_bin = synthetic_pes(stitches);
+            std::ofstream(file, std::ios::binary).write(reinterpret_cast<const char *>(pes_bin.data()), pes_bin.size());
+
+            for (auto latency : result["latencies"].as<std::vector<int>>())
+            {
+                for (auto &mode : all_modes)
+                {
+                    if (std::find(modes.begin(), modes.end(), mode.name) == modes.end())
+                        continue;
+                    auto r = run(file, stitches, latency, mode);
+                    fmt::print("{:<16} {:>8} {:>8} {:>12.0f} {:>9.1f} {:>9.1f} {:>9.1f} {:>10.2f} {:>8.3f}\n",
+                               r.mode, r.stitches, r.latency_us, r.stitches_per_second, r.p50_us, r.p99_us, r.p999_us, r.syscalls_per_stitch, r.cpu_seconds);
+                    results.push_back(r);
+                }
+            }
+            ::unlink(file.c_str());
+        }
+
+        if (result.count("output"))
+        {
+            std::ofstream out(result["output"].as<std::string>());
+            out << "[\n";
+            for (std::size_t i = 0; i < results.size(); i++)
+            {
+                auto &r = results[i];
+                out << fmt::format("  {{\"mode\": \"{}\", \"stitches\": {}, \"latency_us\": {}, \"seconds\": {:.6f}, "
+                                   "\"stitches_per_second\": {:.1f}, \"p50_us\": {:.1f}, \"p99_us\": {:.1f}, \"p999_us\": {:.1f}, "
+                                   "\"syscalls_per_stitch\": {:.3f}, \"cpu_seconds\": {:.6f}}}{}\n",
+                                   r.mode, r.stitches, r.latency_us, r.seconds, r.stitches_per_second, r.p50_us, r.p99_us, r.p999_us,
+                                   r.syscalls_per_stitch, r.cpu_seconds, i + 1 < results.size() ? "," : "");
+            }
+            out << "]\n";
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << "\n"
+                  << options.help();
+        return -1;
+    }
+    return 0;
+}
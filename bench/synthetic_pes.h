@@ -0,0 +1,64 @@
+#ifndef SYNTHETIC_PES_H
+#define SYNTHETIC_PES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Generates a PES file with `stitches` stitches in `colors` color blocks.
+// The design is a mix of short satin stitches, 2-4 mm fill stitches and a
+// jump every few hundred stitches, which is roughly what digitizers produce.
+inline std::vector<unsigned char> synthetic_pes(int stitches, int colors = 4, std::uint32_t seed = 1)
+{
+    auto rnd = [&seed](int n) {
+        seed = seed * 1664525u + 1013904223u;
+        return int((seed >> 8) % unsigned(n));
+    };
+
+    const unsigned pec = 16;
+    std::vector<unsigned char> buf = {'#', 'P', 'E', 'S', '0', '0', '0', '1'};
+    for (int i = 0; i < 4; i++)
+        buf.push_back((pec >> (8 * i)) & 0xFF);
+    buf.resize(pec + 532);
+    buf[pec + 48] = colors - 1;
+    for (int i = 0; i < colors; i++)
+        buf[pec + 49 + i] = 1 + (i * 7) % 64;
+
+    int per_color = stitches / colors + 1;
+    int x = 0, y = 0;
+    for (int i = 0; i < stitches; i++)
+    {
+        if (i > 0 && i % per_color == 0)
+        {
+            buf.insert(buf.end(), {0xFE, 0xB0, 0x00});
+        }
+        int dx, dy;
+        if (rnd(300) == 0)
+        {
+            // jump somewhere else within 8 cm
+            dx = std::min(2000, std::max(-2000, rnd(800) - 400 - x / 4));
+            dy = std::min(2000, std::max(-2000, rnd(800) - 400 - y / 4));
+            for (int val : {dx, dy})
+            {
+                buf.push_back(0x80 | 0x10 | ((val >> 8) & 0x0F));
+                buf.push_back(val & 0xFF);
+            }
+        }
+        else
+        {
+            bool satin = (i / 500) % 2;
+            dx = satin ? ((i % 2) ? 30 : -30) + rnd(3) - 1 : 20 + rnd(20);
+            dy = satin ? ((i / 1000) % 2 ? -3 : 3) : rnd(7) - 3;
+            if ((i / 50) % 2)
+                dx = -dx;
+            buf.push_back(dx & 0x7F);
+            buf.push_back(dy & 0x7F);
+        }
+        x += dx;
+        y += dy;
+    }
+    buf.insert(buf.end(), {0xFF, 0x00});
+    return buf;
+}
+
+#endif /* SYNTHETIC_PES_H */
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <array>
+
+#include "compose.h"
+
+static bool overlap(const pes &a, const pes &b)
+{
+    return a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y;
+}
+
+// A block without stitches would only ask for a thread nobody sews with.
+static void drop_empty_blocks(pes &p)
+{
+    std::vector<pes_block> blocks;
+    for (auto &b : p.blocks)
+    {
+        if (!b.stitches.empty())
+            blocks.push_back(std::move(b));
+    }
+    p.blocks = std::move(blocks);
+}
+
+pes compose(std::vector<placement> designs)
+{
+    for (auto &d : designs)
+        drop_empty_blocks(d.pattern);
+    if (designs.size() == 1 && designs[0].x == 0 && designs[0].y == 0)
+        return std::move(designs[0].pattern);
+
+    pes job;
+    for (auto &d : designs)
+    {
+        auto &p = d.pattern;
+        if (p.min_x > p.max_x)
+            continue;   // no stitches
+        p.min_x += d.x;
+        p.max_x += d.x;
+        p.min_y += d.y;
+        p.max_y += d.y;
+        job.min_x = std::min(job.min_x, p.min_x);
+        job.max_x = std::max(job.max_x, p.max_x);
+        job.min_y = std::min(job.min_y, p.min_y);
+        job.max_y = std::max(job.max_y, p.max_y);
+    }
+
+    auto n = designs.size();
+    std::vector<std::size_t> next(n);
+    auto done = [&](std::size_t i) { return next[i] == designs[i].pattern.blocks.size(); };
+    auto ready = [&](std::size_t j) {
+        if (done(j))
+            return false;
+        for (std::size_t i = 0; i < j; i++)
+        {
+            if (!done(i) && overlap(designs[i].pattern, designs[j].pattern))
+                return false;
+        }
+        return true;
+    };
+
+    while (true)
+    {
+        std::vector<std::size_t> candidates;
+        std::array<int, 256> votes{};
+        for (std::size_t j = 0; j < n; j++)
+        {
+            if (!ready(j))
+                continue;
+            candidates.push_back(j);
+            votes[pes_color_index(designs[j].pattern.blocks[next[j]].block_color)]++;
+        }
+        if (candidates.empty())
+            break;
+
+        // Ties go to the color of the earliest design
+        int best = -1;
+        for (auto j : candidates)
+        {
+            int c = pes_color_index(designs[j].pattern.blocks[next[j]].block_color);
+            if (best < 0 || votes[c] > votes[best])
+                best = c;
+        }
+
+        pes_block block{pes_color(best)};
+        for (auto j : candidates)
+        {
+            auto &source = designs[j].pattern.blocks[next[j]];
+            if (pes_color_index(source.block_color) != best)
+                continue;
+            bool first = true;
+            for (auto s : source.stitches)
+            {
+                s.x += designs[j].x;
+                s.y += designs[j].y;
+                if (first)
+                    s.jumpstitch = std::max(s.jumpstitch, int(jump_stitch));
+                first = false;
+                block.stitches.push_back(s);
+            }
+            next[j]++;
+        }
+        job.colors.push_back(block.block_color);
+        job.blocks.push_back(std::move(block));
+    }
+    return job;
+}
@@ -0,0 +1,27 @@
+#ifndef COMPOSE_H
+#define COMPOSE_H
+
+#include <vector>
+
+#include "pes.h"
+
+// A design and where its origin goes in the hoop, in 1/10 mm.
+struct placement {
+    pes pattern;
+    int x{}, y{};
+};
+
+// Puts several designs into one hoop as one job with as few color changes
+// as the designs allow.
+//
+// The next block is always the color that most of the designs continue
+// with, and it takes the next block of every design that continues with
+// that color, so each design keeps the order of its own colors. A design
+// whose bounds overlap an earlier one only starts once that one is done,
+// so it is still sewn on top of it. Within a block the designs follow each
+// other in the given order, the first stitch of each is a jump.
+// Blocks without stitches are dropped, so designs without stitches add
+// nothing. Apart from that a single design at 0/0 is returned as it is.
+pes compose(std::vector<placement> designs);
+
+#endif /* COMPOSE_H */
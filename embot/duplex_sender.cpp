@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "duplex_sender.h"
+#include "trace.h"
+
+static const std::size_t tx_capacity = 1024;
+static const std::size_t rx_capacity = 4096;
+
+duplex_sender::duplex_sender(serial::Serial &ser, int window, int timeout_ms, std::ostream *log)
+    : ser_(ser), window_(window), timeout_ms_(timeout_ms), log_(log),
+      tx_(tx_capacity), sent_(tx_capacity), rx_(rx_capacity)
+{
+    if (window_ < 1 || window_ > int(tx_capacity))
+        throw std::invalid_argument("window has to be between 1 and 1024");
+    writer_thread_ = std::thread(&duplex_sender::writer, this);
+    reader_thread_ = std::thread(&duplex_sender::reader, this);
+}
+
+duplex_sender::~duplex_sender()
+{
+    stop_ = true;
+    writer_bell_.ring();
+    wake_reader();
+    writer_thread_.join();
+    reader_thread_.join();
+    // The reader may have returned before it saw the cancel, the next
+    // wait on the port must not see it either.
+    try
+    {
+        ser_.clearCancel();
+    }
+    catch (...)
+    {
+    }
+}
+
+void duplex_sender::send(const unsigned char *cmmd, std::size_t size)
+{
+    if (size > max_command_size)
+        throw std::invalid_argument("command too long");
+
+    auto slot = wait_for_slot();
+    std::memcpy(slot->bytes, cmmd, size);
+    slot->size = size;
+    tx_.commit();
+    submitted_++;
+    writer_bell_.ring();
+
+    process_replies();
+    check_failed();
+}
+
+void duplex_sender::send_run(const unsigned char *data, const std::uint32_t *offsets, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto size = offsets[i + 1] - offsets[i];
+        if (size > max_command_size)
+            throw std::invalid_argument("command too long");
+        auto slot = tx_.alloc();
+        if (!slot)
+        {
+            // Let the writer start on what is queued before waiting for room.
+            writer_bell_.ring();
+            slot = wait_for_slot();
+        }
+        std::memcpy(slot->bytes, data + offsets[i], size);
+        slot->size = size;
+        tx_.commit();
+        submitted_++;
+    }
+    writer_bell_.ring();
+
+    process_replies();
+    check_failed();
+}
+
+duplex_sender::tx_command *duplex_sender::wait_for_slot()
+{
+    tx_command *slot;
+    while (!(slot = tx_.alloc()))
+    {
+        process_replies();
+        check_failed();
+        caller_bell_.wait([this] { return failed_ || !rx_.empty() || tx_.alloc(); });
+    }
+    return slot;
+}
+
+void duplex_sender::drain()
+{
+    while (answered_ < submitted_)
+    {
+        process_replies();
+        check_failed();
+        caller_bell_.wait([this] { return failed_ || !rx_.empty() || answered_ >= submitted_; });
+    }
+    process_replies();
+    check_failed();
+}
+
+void duplex_sender::process_replies()
+{
+    while (auto r = rx_.front())
+    {
+        if (log_)
+            *log_ << (r->reply) << "\n";
+        if (latencies_ && r->reply != reply_busy)
+            latencies_->push_back(r->latency);
+        rx_.pop();
+    }
+    reader_bell_.ring();
+}
+
+void duplex_sender::check_failed()
+{
+    if (failed_)
+        std::rethrow_exception(error_);
+}
+
+void duplex_sender::fail(std::exception_ptr error)
+{
+    if (failing_.exchange(true))
+        return;
+    error_ = error;
+    failed_ = true;
+    stop_ = true;
+    caller_bell_.ring();
+    writer_bell_.ring();
+    wake_reader();
+}
+
+void duplex_sender::wake_reader()
+{
+    reader_bell_.ring();
+    try
+    {
+        ser_.cancelWait();
+    }
+    catch (...)
+    {
+        // The reader still notices the stop when its wait times out.
+    }
+}
+
+void duplex_sender::writer()
+{
+    std::vector<unsigned char> out;
+    trace_thread_name("writer");
+    try
+    {
+        while (true)
+        {
+            writer_bell_.wait([this] {
+                return stop_ || (!busy_ && written_ - answered_ < window_ && !tx_.empty());
+            });
+            if (stop_)
+                return;
+
+            // Everything that fits into the window and the output queue goes out
+            // with one write.
+            out.clear();
+            long count = 0;
+            auto now = clock::now();
+            while (auto cmd = tx_.front())
+            {
+                if (written_ + count - answered_ >= window_ || out.size() + cmd->size > max_write_size)
+                    break;
+                out.insert(out.end(), cmd->bytes, cmd->bytes + cmd->size);
+                sent_.push(now);
+                tx_.pop();
+                count++;
+            }
+            caller_bell_.ring();
+
+            {
+                EMBOT_TRACE_SCOPE(trace_phase::flush, written_, count);
+                wait_output_queue(ser_, output_watermark_, timeout_ms_);
+            }
+            {
+                EMBOT_TRACE_SCOPE(trace_phase::write, written_, count);
+                write_all(ser_, out.data(), out.size(), timeout_ms_);
+            }
+            written_ += count;
+        }
+    }
+    catch (...)
+    {
+        fail(std::current_exception());
+    }
+}
+
+void duplex_sender::reader()
+{
+    unsigned char buf[256];
+    trace_thread_name("reader");
+    try
+    {
+        auto last_reply = clock::now();
+        while (!stop_)
+        {
+            if (ser_.available() < 1)
+            {
+                // Sleep until the oldest command would time out, a stop
+                // request cancels the wait.
+                auto timeout = std::chrono::milliseconds(timeout_ms_);
+                auto oldest = sent_.front();
+                auto wait = oldest ? std::max(*oldest, last_reply) + timeout - clock::now() : timeout;
+                auto wait_ms = std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+                {
+                    EMBOT_TRACE_SCOPE(trace_phase::wait, answered_);
+                    ser_.waitReadable(uint32_t(std::clamp<long long>(wait_ms, 0, timeout_ms_)));
+                }
+                oldest = sent_.front();
+                auto now = clock::now();
+                if (oldest && now - std::max(*oldest, last_reply) > timeout)
+                    throw std::runtime_error("timeout while waiting for a reply of the firmware");
+                continue;
+            }
+
+            auto n = ser_.read(buf, sizeof(buf));
+            auto now = clock::now();
+            last_reply = now;
+            for (std::size_t i = 0; i < n; i++)
+            {
+                rx_reply r{char(buf[i]), {}};
+                if (r.reply == reply_rejected)
+                    throw std::runtime_error("the firmware rejected a command");
+                if (r.reply == reply_busy)
+                {
+                    busy_ = true;
+                }
+                else
+                {
+                    if (auto sent = sent_.front())
+                    {
+                        r.latency = now - *sent;
+                        EMBOT_TRACE_RECORD(trace_phase::ack, *sent, now, answered_);
+                        sent_.pop();
+                    }
+                    busy_ = false;
+                    answered_++;
+                }
+                while (!rx_.push(r))
+                {
+                    caller_bell_.ring();
+                    reader_bell_.wait([this] { return stop_ || rx_.alloc(); });
+                    if (stop_)
+                        return;
+                }
+            }
+            writer_bell_.ring();
+            caller_bell_.ring();
+        }
+    }
+    catch (...)
+    {
+        fail(std::current_exception());
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef DUPLEX_SENDER_H
+#define DUPLEX_SENDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "protocol.h"
+#include "sender.h"
+#include "spsc_ring.h"
+
+// Full duplex variant of command_sender with the same window and busy
+// handling, but the port is driven by two threads of its own:
+//
+//   caller --tx--> writer thread --> port --> reader thread --rx--> caller
+//
+// The caller encodes commands into the tx ring, the writer thread writes
+// them to the port as soon as the window allows, several at once if
+// possible, and the reader thread matches the replies to the commands and
+// hands them back through the rx ring. All rings are lock-free and have
+// exactly one producer and one consumer; threads only park on a doorbell
+// when there is nothing to do.
+//
+// Replies are echoed to `log` and latencies are recorded on the caller's
+// thread, so a slow terminal never holds up the link. Errors of the port
+// threads are rethrown by the next call to send or drain.
+class duplex_sender : public command_link
+{
+public:
+    duplex_sender(serial::Serial &ser, int window = 1, int timeout_ms = 30000, std::ostream *log = nullptr);
+    ~duplex_sender() override;
+
+    using command_link::send;
+    void send(const unsigned char *cmmd, std::size_t size) override;
+    void send_run(const unsigned char *data, const std::uint32_t *offsets, std::size_t count) override;
+    void drain() override;
+
+private:
+    struct tx_command {
+        std::size_t size;
+        unsigned char bytes[max_command_size];
+    };
+
+    struct rx_reply {
+        char reply;
+        clock::duration latency;
+    };
+
+    // Lets a thread sleep until another one changed something it waits for.
+    class doorbell
+    {
+    public:
+        void ring()
+        {
+            // Taking the lock orders the change before the waiter's check.
+            { std::lock_guard<std::mutex> lock(mutex_); }
+            cv_.notify_all();
+        }
+
+        template <typename Pred>
+        void wait(Pred pred)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, pred);
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+    };
+
+    tx_command *wait_for_slot();
+    void writer();
+    void reader();
+    void process_replies();
+    void check_failed();
+    void fail(std::exception_ptr error);
+    void wake_reader();
+
+    serial::Serial &ser_;
+    int window_;
+    int timeout_ms_;
+    std::ostream *log_;
+
+    spsc_ring<tx_command> tx_;              // caller -> writer
+    spsc_ring<clock::time_point> sent_;     // writer -> reader, when each command was written
+    spsc_ring<rx_reply> rx_;                // reader -> caller
+
+    long submitted_{};                      // only used by the caller
+    std::atomic<long> written_{0};
+    std::atomic<long> answered_{0};
+    std::atomic<bool> busy_{false};
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> failed_{false};
+    std::atomic<bool> failing_{false};      // set by the first thread that fails
+    std::exception_ptr error_;
+
+    doorbell caller_bell_, writer_bell_, reader_bell_;
+    std::thread writer_thread_, reader_thread_;
+};
+
+#endif /* DUPLEX_SENDER_H */
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <fmt/core.h>
+
+#include "job.h"
+#include "machine.h"
+#include "trace.h"
+
+wire_format negotiate_format(const std::string &handshake_reply, bool ascii_only, int stitches_per_frame)
+{
+    wire_format format;
+    format.binary_frames = !ascii_only && supports_binary_frames(handshake_reply);
+    format.stitch_frames = !ascii_only && supports_stitch_frames(handshake_reply);
+    format.stitches_per_frame = stitches_per_frame;
+    return format;
+}
+
+// One stitch is one needle cycle: the hoop moves to the stitch position
+// during the ticks_hoop_moving ticks while the needle is up and stands still
+// for the rest of the rotation. The hoop always gets the whole window. Both
+// parts turn at the same speed, so a shorter window would not make the
+// cycle any shorter, it would only drive the hoop harder.
+// For jump stitches the hoop moves first and the needle follows afterwards.
+static stitch_command needle_cycle(const stitch &s, const stitch &previous, int x_offset, int y_offset, bool hoop_model)
+{
+    // With the hoop model a stitch too long to sew even at the lowest speed
+    // is sewn like a jump stitch.
+    if (s.jumpstitch == 0 &&
+        (!hoop_model ||
+         hoop_moving_ticks(std::max(std::abs(s.x - previous.x), std::abs(s.y - previous.y)), s.speed) <= ticks_hoop_moving))
+        return {x_offset + s.x, y_offset + s.y, ticks_hoop_moving, ticks_hoop_not_moving, s.speed};
+    return {x_offset + s.x, y_offset + s.y, 0, ticks_per_stitch, s.speed};
+}
+
+job_compiler::job_compiler(compiled_job &job, const wire_format &format) : job_(job), format_(format)
+{
+}
+
+void job_compiler::add(const stitch_command &cycle)
+{
+    if (format_.stitch_frames)
+    {
+        batch_.push_back(cycle);
+        if (int(batch_.size()) == format_.stitches_per_frame)
+            flush();
+    }
+    else
+    {
+        add_move({cycle.x, cycle.y, cycle.moving, cycle.speed});
+        add_move({cycle.x, cycle.y, cycle.stationary, cycle.speed});
+    }
+}
+
+void job_compiler::add_traversal(int x, int y, int speed)
+{
+    if (format_.stitch_frames)
+        add({x, y, 0, 0, speed});
+    else
+        add_move({x, y, 0, speed});
+}
+
+void job_compiler::end_block()
+{
+    flush();
+    job_.blocks.push_back(job_.commands());
+}
+
+void job_compiler::add_move(const move_command &cmd)
+{
+    if (format_.binary_frames)
+    {
+        auto pos = job_.bytes.size();
+        job_.bytes.resize(pos + move_frame_size);
+        encode_move_frame(cmd, seq_++, job_.bytes.data() + pos);
+    }
+    else
+    {
+        auto cmmd = ascii_move(cmd);
+        job_.bytes.insert(job_.bytes.end(), cmmd.begin(), cmmd.end());
+    }
+    job_.offsets.push_back(job_.bytes.size());
+}
+
+void job_compiler::flush()
+{
+    if (batch_.empty())
+        return;
+    auto pos = job_.bytes.size();
+    job_.bytes.resize(pos + stitch_frame_size(batch_.size()));
+    encode_stitch_frame(batch_.data(), batch_.size(), seq_++, job_.bytes.data() + pos);
+    job_.offsets.push_back(job_.bytes.size());
+    batch_.clear();
+}
+
+// The hoop starts at 0/0 of the machine, which is -offset of the design.
+cycle_builder::cycle_builder(job_compiler &compiler, int x_offset, int y_offset, bool hoop_model)
+    : compiler_(compiler), x_offset_(x_offset), y_offset_(y_offset), hoop_model_(hoop_model), previous_{-x_offset, -y_offset, 0}
+{
+}
+
+void cycle_builder::add(const stitch &s)
+{
+    if (s.jumpstitch)
+    {
+        // The jump stitches before in the chain are passed over
+        jump_ = s;
+        in_chain_ = true;
+        return;
+    }
+    if (in_chain_)
+        add_jump();
+    compiler_.add(needle_cycle(s, previous_, x_offset_, y_offset_, hoop_model_));
+    previous_ = s;
+}
+
+void cycle_builder::end_block()
+{
+    if (in_chain_)
+        add_jump();
+    compiler_.end_block();
+}
+
+void cycle_builder::add_jump()
+{
+    int dx = jump_.x - previous_.x, dy = jump_.y - previous_.y;
+    int moves = (std::max(std::abs(dx), std::abs(dy)) + max_hoop_travel - 1) / max_hoop_travel;
+    // The needle cycle of the jump stitch itself makes the last move
+    for (int i = 1; i < moves; i++)
+        compiler_.add_traversal(x_offset_ + previous_.x + dx * i / moves, y_offset_ + previous_.y + dy * i / moves,
+                                jump_.speed);
+    compiler_.add(needle_cycle(jump_, previous_, x_offset_, y_offset_, hoop_model_));
+    previous_ = jump_;
+    in_chain_ = false;
+}
+
+compiled_job compile_job(const pes &pattern, const wire_format &format, bool hoop_model)
+{
+    int x_offset = pattern.min_x < 0 ? -pattern.min_x : 0;
+    int y_offset = pattern.min_y < 0 ? -pattern.min_y : 0;
+
+    compiled_job job;
+    job_compiler compiler(job, format);
+    cycle_builder cycles(compiler, x_offset, y_offset, hoop_model);
+    for (auto &block : pattern.blocks)
+    {
+        EMBOT_TRACE_SCOPE(trace_phase::compile, job.blocks.size() - 1, block.stitches.size());
+        for (auto s : block.stitches)
+            cycles.add(s);
+        cycles.end_block();
+    }
+    return job;
+}
+
+// ASCII commands are echoed as they are, frames are decoded for the echo.
+static void log_commands(std::ostream &log, const compiled_job &job, std::size_t first, std::size_t last)
+{
+    command_decoder decoder;
+    for (auto i = first; i < last; i++)
+    {
+        auto cmmd = job.bytes.data() + job.offsets[i];
+        auto size = job.offsets[i + 1] - job.offsets[i];
+        if (cmmd[0] != frame_sync)
+        {
+            log.write(reinterpret_cast<const char *>(cmmd), size) << "\n";
+            continue;
+        }
+        command_decoder::result r{};
+        for (std::size_t j = 0; j < size; j++)
+            r = decoder.push(cmmd[j]);
+        if (r == command_decoder::move)
+            log << fmt::format("#{} {} {} {} {}", decoder.seq, decoder.cmd.x, decoder.cmd.y, decoder.cmd.mot, decoder.cmd.speed) << "\n";
+        for (std::size_t j = 0; r == command_decoder::stitches && j < decoder.stitch_count; j++)
+        {
+            auto &cmd = decoder.stitch_cmds[j];
+            log << fmt::format("#{} {} {} {} {} {}", decoder.seq, cmd.x, cmd.y, cmd.moving, cmd.stationary, cmd.speed) << "\n";
+        }
+    }
+}
+
+job_sender::job_sender(command_link &sender, const wire_format &format, const pes &pattern, std::ostream *log,
+                       bool hoop_model)
+    : sender_(sender), log_(log), job_(compile_job(pattern, format, hoop_model))
+{
+}
+
+void job_sender::send_block(std::size_t idx)
+{
+    auto first = job_.blocks[idx], last = job_.blocks[idx + 1];
+    if (log_)
+        log_commands(*log_, job_, first, last);
+    sender_.send_run(job_.bytes.data(), job_.offsets.data() + first, last - first);
+    sender_.drain();
+}
+
+job_streamer::job_streamer(command_link &sender, const wire_format &format, const pes &bounds, pec_decoder stitches,
+                           std::ostream *log, bool hoop_model)
+    : sender_(sender), log_(log), stitches_(stitches), planner_(hoop_model), compiler_(chunk_, format),
+      cycles_(compiler_, bounds.min_x < 0 ? -bounds.min_x : 0, bounds.min_y < 0 ? -bounds.min_y : 0, hoop_model)
+{
+}
+
+bool job_streamer::next_block()
+{
+    while (!at_end_)
+    {
+        switch (stitches_.next(first_))
+        {
+        case pec_decoder::stitch_record:
+            return true;
+        case pec_decoder::color_change:
+            break;
+        case pec_decoder::end:
+            at_end_ = true;
+            break;
+        }
+    }
+    return false;
+}
+
+void job_streamer::send_block()
+{
+    planner_.push(first_);
+    stitch s;
+    while (true)
+    {
+        auto r = stitches_.next(s);
+        if (r != pec_decoder::stitch_record)
+        {
+            at_end_ = r == pec_decoder::end;
+            break;
+        }
+        planner_.push(s);
+        plan();
+        if (chunk_.commands() >= chunk_commands)
+            send_chunk();
+    }
+    planner_.end_block();
+    plan();
+    cycles_.end_block();
+    send_chunk();
+    sender_.drain();
+}
+
+void job_streamer::plan()
+{
+    stitch s;
+    while (planner_.pop(s))
+        cycles_.add(s);
+}
+
+void job_streamer::send_chunk()
+{
+    if (log_)
+        log_commands(*log_, chunk_, 0, chunk_.commands());
+    sender_.send_run(chunk_.bytes.data(), chunk_.offsets.data(), chunk_.commands());
+    chunk_.bytes.clear();
+    chunk_.offsets.resize(1);
+    chunk_.blocks.resize(1);
+}
@@ -0,0 +1,147 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "pes.h"
+#include "planner.h"
+#include "protocol.h"
+#include "sender.h"
+
+// How the stitches are put on the wire, see protocol.h
+struct wire_format {
+    bool binary_frames{};
+    bool stitch_frames{};
+    int stitches_per_frame{8};
+};
+
+// Picks the best format the firmware announced in its reply to `>e`.
+wire_format negotiate_format(const std::string &handshake_reply, bool ascii_only, int stitches_per_frame);
+
+// A whole job serialized into the bytes that go over the wire.
+// All commands lie back to back in `bytes`, command i is the slice from
+// offsets[i] to offsets[i + 1]. The commands of color block b are the ones
+// from blocks[b] to blocks[b + 1].
+struct compiled_job {
+    std::vector<unsigned char> bytes;
+    std::vector<std::uint32_t> offsets{0};
+    std::vector<std::size_t> blocks{0};
+
+    std::size_t commands() const { return offsets.size() - 1; }
+};
+
+// Appends needle cycles to a compiled job, encoded in the given format.
+// Stitch frames are only completed by the next cycles or `end_block`.
+class job_compiler
+{
+public:
+    job_compiler(compiled_job &job, const wire_format &format);
+
+    void add(const stitch_command &cycle);
+    // Moves the hoop to x/y without turning the needle.
+    void add_traversal(int x, int y, int speed);
+    void end_block();
+
+private:
+    void add_move(const move_command &cmd);
+    void flush();
+
+    compiled_job &job_;
+    wire_format format_;
+    std::uint8_t seq_{};
+    std::vector<stitch_command> batch_;
+};
+
+// Turns planned stitches into needle cycles for a job_compiler.
+//
+// A chain of jump stitches becomes one traversal of the hoop with the needle
+// parked, straight to the last jump stitch of the chain, where the needle
+// cycles once. Traversals longer than max_hoop_travel are split into equal
+// moves. Chains do not reach over the end of a color block.
+//
+// Every normal stitch is split into ticks_hoop_moving ticks while the hoop
+// moves and ticks_hoop_not_moving while it stands still. With `hoop_model`
+// (see calc_speed) a normal stitch the hoop can't cover within
+// ticks_hoop_moving at its planned speed, which is only the case for very
+// long stitches that are already at the lowest speed, is sewn like a jump
+// stitch.
+class cycle_builder
+{
+public:
+    cycle_builder(job_compiler &compiler, int x_offset, int y_offset, bool hoop_model = false);
+
+    void add(const stitch &s);
+    void end_block();
+
+private:
+    void add_jump();
+
+    job_compiler &compiler_;
+    int x_offset_, y_offset_;
+    bool hoop_model_;
+    stitch previous_;           // where the hoop is
+    stitch jump_{};             // last jump stitch of the current chain
+    bool in_chain_{};
+};
+
+compiled_job compile_job(const pes &pattern, const wire_format &format, bool hoop_model = false);
+
+// Sends a compiled job block by block. Sending does not format or
+// allocate anything, it only hands slices of the compiled job to the link.
+// Every command is echoed to `log` unless it is null.
+class job_sender
+{
+public:
+    // `hoop_model` like for cycle_builder
+    job_sender(command_link &sender, const wire_format &format, const pes &pattern, std::ostream *log = nullptr,
+               bool hoop_model = false);
+
+    // Sends all stitches of color block `idx` and waits for their replies.
+    void send_block(std::size_t idx);
+
+    const compiled_job &job() const { return job_; }
+
+private:
+    command_link &sender_;
+    std::ostream *log_;
+    compiled_job job_;
+};
+
+// Decodes, plans and sends a job in one pass, so the first command goes
+// out right away whatever the size of the design. Only the stitches held
+// back by the planner and one chunk of encoded commands are kept.
+// `bounds` supplies the offsets, see parse_pes_header.
+class job_streamer
+{
+public:
+    // `hoop_model` like for calc_speed and cycle_builder
+    job_streamer(command_link &sender, const wire_format &format, const pes &bounds, pec_decoder stitches,
+                 std::ostream *log = nullptr, bool hoop_model = false);
+
+    // Skips to the next color block, false if there is none.
+    bool next_block();
+
+    // Sends the block found by next_block and waits for its replies.
+    void send_block();
+
+private:
+    static constexpr std::size_t chunk_commands = 64;
+
+    void plan();
+    void send_chunk();
+
+    command_link &sender_;
+    std::ostream *log_;
+    pec_decoder stitches_;
+    speed_planner planner_;
+    compiled_job chunk_;
+    job_compiler compiler_;
+    cycle_builder cycles_;
+    stitch first_{};
+    bool at_end_{};
+};
+
+#endif /* JOB_H */
@@ -0,0 +1,52 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+// Calculate ticks per rotation (one stitch)
+// facts (for my setup):
+// 200 steps per one motor rotation
+// microstepping: 16 ticks per step
+// 16 teeth pulley on the motor
+// 58 teeth pulley on the sewing machine
+// -> 200*16*(58/16) = 11600
+constexpr int ticks_per_stitch = 11600;
+
+// Calculate the part of the stitch, when the hoop is able to move.
+// Only a quater of one stitch rotation can be used to move the hoop.
+// The beginning of this Part is, when the needle is on it's highes position.
+// This is the point when the sewing thread is free in will not break.
+constexpr int ticks_hoop_moving = (ticks_per_stitch / 4);
+
+// ... the spare ticks belong to the part, when the hoop is not moving.
+// If there is a remainder of the division, add it to this part.
+// ticks_hoop_moving + ticks_hoop_not_moving has to be exactly ticks_per_stitch,
+// otherwise the stitches drift away and it's possible that the needle is in the Fabric,
+// when the hoop moves.
+constexpr int ticks_hoop_not_moving = (ticks_per_stitch / 4) * 3 + ticks_per_stitch % 4;
+
+// This is the max speed value on which the stepper motor of the sewing machine
+// will properly work.
+// You have to try it out.
+// This value works on my setup.
+constexpr int max_speed = 900;
+
+// The model of the hoop the planner can limit the speed with (see
+// hoop_speed_limit). These three are uncalibrated placeholders, none of
+// them was measured on a machine, so the model is only used when asked
+// for (term_control --hoop-model). Measure them on your setup first.
+
+// The needle motor turns this many ticks per second per unit of speed.
+constexpr int ticks_per_second_per_speed = 128;
+
+// Limits of the hoop on each axis, in mm/s and mm/s^2.
+// The hoop has to cover the distance to the next stitch while the needle
+// motor turns ticks_hoop_moving ticks, so long stitches need a lower speed.
+// With these placeholders stitches up to about 3 mm go with max_speed.
+constexpr int hoop_max_velocity = 300;
+constexpr int hoop_max_acceleration = 20000;
+
+// Farthest the hoop is sent with one command, in 1/10 mm on each axis.
+// This is the longest stitch a PEC file can hold, so the firmware has always
+// seen moves this long. Longer traversals are split into several moves.
+constexpr int max_hoop_travel = 2047;
+
+#endif /* MACHINE_H */
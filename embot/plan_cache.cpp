@@ -0,0 +1,329 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <system_error>
+
+#include <fmt/core.h>
+
+#include "compose.h"
+#include "machine.h"
+#include "plan_cache.h"
+#include "planner.h"
+#include "stitch_filter.h"
+#include "travel.h"
+
+static const char cache_magic[8] = {'E', 'M', 'B', 'O', 'T', 'P', 'C', '3'};
+
+static std::size_t padded(std::size_t size)
+{
+    return (size + 7) / 8 * 8;
+}
+
+// 64-bit FNV-1a
+constexpr std::uint64_t fnv1a_basis = 14695981039346656037ull;
+
+static std::uint64_t fnv1a(const void *data, std::size_t size, std::uint64_t hash = fnv1a_basis)
+{
+    auto p = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// CRC-32 (IEEE 802.3, reflected), a second check next to the hash
+static const auto crc32_table = [] {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t i = 0; i < 256; i++)
+    {
+        auto c = i;
+        for (int bit = 0; bit < 8; bit++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}();
+
+static std::uint32_t crc32(const void *data, std::size_t size, std::uint32_t crc = 0)
+{
+    auto p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; i++)
+        crc = crc32_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Reads an entry front to back, every read is checked against the end.
+struct entry_reader {
+    const unsigned char *p, *end;
+
+    const unsigned char *take(std::size_t size)
+    {
+        if (std::size_t(end - p) < size)
+            return nullptr;
+        auto at = p;
+        p += size;
+        return at;
+    }
+
+    template <typename T>
+    bool read(T &value)
+    {
+        auto at = take(sizeof(T));
+        if (at)
+            std::memcpy(&value, at, sizeof(T));
+        return at;
+    }
+};
+
+template <typename T>
+static void write_value(std::ofstream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static void write_padding(std::ofstream &out, std::size_t size)
+{
+    static const char zeros[8] = {};
+    out.write(zeros, padded(size) - size);
+}
+
+plan_cache::plan_cache(std::filesystem::path dir, std::uintmax_t max_bytes) : dir_(std::move(dir)), max_bytes_(max_bytes)
+{
+}
+
+std::filesystem::path plan_cache::default_dir()
+{
+    if (auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        return std::filesystem::path(xdg) / "embot";
+    if (auto home = std::getenv("HOME"); home && *home)
+        return std::filesystem::path(home) / ".cache" / "embot";
+    return std::filesystem::temp_directory_path() / "embot";
+}
+
+plan_key plan_cache::key(const std::vector<design_file> &designs, const plan_options &options)
+{
+    plan_key k{fnv1a_basis};
+    auto add = [&k](const void *data, std::size_t size) {
+        k.hash = fnv1a(data, size, k.hash);
+        k.crc = crc32(data, size, k.crc);
+    };
+    for (auto &design : designs)
+    {
+        const std::uint64_t placement[] = {design.bytes.size, std::uint64_t(design.x), std::uint64_t(design.y)};
+        add(placement, sizeof(placement));
+        add(design.bytes.data, design.bytes.size);
+        k.source_size += design.bytes.size;
+    }
+    const int inputs[] = {ticks_per_stitch, ticks_hoop_moving, ticks_hoop_not_moving, max_speed,
+                          ticks_per_second_per_speed, hoop_max_velocity, hoop_max_acceleration,
+                          max_hoop_travel, speed_ramp_step, planner_version, options.optimize_travel, options.hoop_model,
+                          options.min_stitch, options.drop_duplicates};
+    add(inputs, sizeof(inputs));
+    add(cache_magic, sizeof(cache_magic));
+    return k;
+}
+
+std::filesystem::path plan_cache::entry(const plan_key &key) const
+{
+    return dir_ / fmt::format("{:016x}.plan", key.hash);
+}
+
+std::optional<pes> plan_cache::load(const plan_key &key, plan_report *report) const
+{
+    auto path = entry(key);
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(path, ec))
+        return std::nullopt;
+
+    std::unique_ptr<mapped_file> file;
+    try
+    {
+        file = std::make_unique<mapped_file>(path);
+    }
+    catch (const char *)
+    {
+        return std::nullopt;
+    }
+    auto bytes = file->bytes();
+    entry_reader in{bytes.data, bytes.data + bytes.size};
+
+    auto magic = in.take(sizeof(cache_magic));
+    plan_key stored_key;
+    std::uint32_t zero;
+    plan_report stored_report;
+    pes pattern;
+    std::uint32_t nr_colors, nr_blocks;
+    if (!magic || std::memcmp(magic, cache_magic, sizeof(cache_magic)) || !in.read(stored_key.hash) ||
+        !in.read(stored_key.source_size) || !in.read(stored_key.crc) || !in.read(zero) || stored_key.hash != key.hash ||
+        stored_key.source_size != key.source_size || stored_key.crc != key.crc ||
+        !in.read(stored_report.dropped_stitches) || !in.read(stored_report.seconds_saved) || !in.read(pattern.min_x) || !in.read(pattern.max_x) || !in.read(pattern.min_y) || !in.read(pattern.max_y) ||
+        !in.read(nr_colors) || !in.read(nr_blocks))
+        return std::nullopt;
+
+    auto colors = in.take(padded(nr_colors));
+    if (!colors)
+        return std::nullopt;
+    for (std::uint32_t i = 0; i < nr_colors; i++)
+        pattern.colors.push_back(pes_color(colors[i]));
+
+    for (std::uint32_t b = 0; b < nr_blocks; b++)
+    {
+        std::uint32_t color_idx, n;
+        if (!in.read(color_idx) || !in.read(n) || color_idx > 255)
+            return std::nullopt;
+        auto jumps = in.take(8 * ((std::size_t(n) + 63) / 64));
+        auto arrays = in.take(padded(6 * std::size_t(n)));
+        if (!jumps || !arrays)
+            return std::nullopt;
+        pattern.blocks.push_back({pes_color(color_idx)});
+        pattern.blocks.back().stitches.assign(reinterpret_cast<const std::int16_t *>(arrays),
+                                              reinterpret_cast<const std::int16_t *>(arrays + 2 * n),
+                                              reinterpret_cast<const std::uint64_t *>(jumps),
+                                              reinterpret_cast<const std::uint16_t *>(arrays + 4 * n), n);
+    }
+    // The modification time tells evict which entries were used last.
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    if (report)
+        *report = stored_report;
+    return pattern;
+}
+
+bool plan_cache::store(const plan_key &key, const pes &pattern, const plan_report &report) const
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+
+    // Written under a name of its own and renamed, so readers never see a
+    // partial entry.
+    auto path = entry(key);
+    auto tmp = path;
+    tmp += fmt::format(".{}.tmp", getpid());
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(cache_magic, sizeof(cache_magic));
+        write_value(out, key.hash);
+        write_value(out, key.source_size);
+        write_value(out, key.crc);
+        write_value(out, std::uint32_t(0));
+        write_value(out, report.dropped_stitches);
+        write_value(out, report.seconds_saved);
+        write_value(out, pattern.min_x);
+        write_value(out, pattern.max_x);
+        write_value(out, pattern.min_y);
+        write_value(out, pattern.max_y);
+        write_value(out, std::uint32_t(pattern.colors.size()));
+        write_value(out, std::uint32_t(pattern.blocks.size()));
+        for (const color &c : pattern.colors)
+            write_value(out, pes_color_index(c));
+        write_padding(out, pattern.colors.size());
+
+        for (auto &block : pattern.blocks)
+        {
+            auto &stitches = block.stitches;
+            auto n = stitches.size();
+            write_value(out, std::uint32_t(pes_color_index(block.block_color)));
+            write_value(out, std::uint32_t(n));
+            out.write(reinterpret_cast<const char *>(stitches.jump_words()), 8 * ((n + 63) / 64));
+            out.write(reinterpret_cast<const char *>(stitches.xs()), 2 * n);
+            out.write(reinterpret_cast<const char *>(stitches.ys()), 2 * n);
+            out.write(reinterpret_cast<const char *>(stitches.speeds()), 2 * n);
+            write_padding(out, 6 * n);
+        }
+        if (!out.flush())
+        {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    evict();
+    return true;
+}
+
+void plan_cache::evict() const
+{
+    struct cached_entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type used;
+        std::uintmax_t size;
+    };
+    std::vector<cached_entry> entries;
+    std::uintmax_t total = 0;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (it->path().extension() != ".plan")
+            continue;
+        std::error_code entry_ec;
+        auto size = it->file_size(entry_ec);
+        auto used = it->last_write_time(entry_ec);
+        if (entry_ec)
+            continue;
+        entries.push_back({it->path(), used, size});
+        total += size;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) { return a.used < b.used; });
+    for (auto &e : entries)
+    {
+        if (total <= max_bytes_)
+            break;
+        if (std::filesystem::remove(e.path, ec))
+            total -= e.size;
+    }
+}
+
+pes plan_cache::plan(const std::vector<design_file> &designs, const plan_options &options, plan_report *report)
+{
+    std::vector<placement> placed;
+    for (auto &design : designs)
+        placed.push_back({parse_pes(design.bytes), design.x, design.y});
+    pes pattern = compose(std::move(placed));
+    if (options.optimize_travel)
+        optimize_travel(pattern);
+
+    // Before calc_speed, which makes the last stitch of every block a jump
+    auto min_length = std::max(options.min_stitch, options.drop_duplicates ? 1 : 0);
+    plan_report filtered;
+    if (min_length > 0)
+    {
+        pes unfiltered = pattern;
+        calc_speed(unfiltered, options.hoop_model);
+        filtered.seconds_saved = job_seconds(unfiltered);
+        filtered.dropped_stitches = filter_stitches(pattern, min_length);
+    }
+    calc_speed(pattern, options.hoop_model);
+    if (min_length > 0)
+        filtered.seconds_saved -= job_seconds(pattern);
+    if (report)
+        *report = filtered;
+    return pattern;
+}
+
+pes plan_cache::load_or_plan(const std::vector<design_file> &designs, const plan_options &options,
+                             plan_report *report) const
+{
+    auto k = key(designs, options);
+    if (auto cached = load(k, report))
+        return std::move(*cached);
+
+    plan_report planned;
+    pes pattern = plan(designs, options, &planned);
+    store(k, pattern, planned);
+    if (report)
+        *report = planned;
+    return pattern;
+}
@@ -0,0 +1,111 @@
+#ifndef PLAN_CACHE_H
+#define PLAN_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+#include "pes.h"
+
+// A PES file and where its origin goes in the hoop, in 1/10 mm.
+struct design_file {
+    byte_span bytes;
+    int x{}, y{};
+};
+
+// Optional passes over the design before it is planned.
+struct plan_options {
+    bool optimize_travel{};     // see optimize_travel
+    bool hoop_model{};          // see calc_speed
+    int min_stitch{};           // in 1/10 mm, see filter_stitches, 0 keeps all
+    bool drop_duplicates{};     // filter_stitches exact duplicates even without min_stitch
+};
+
+// Identifies the cache entry of a job. The entry is named after `hash`,
+// the size and a CRC-32 of the same input are stored in it and compared
+// on load, so jobs whose hashes collide do not get each other's plan.
+struct plan_key {
+    std::uint64_t hash{};
+    std::uint64_t source_size{};    // bytes of all PES files
+    std::uint32_t crc{};
+};
+
+// What the filter of plan took out of the job.
+struct plan_report {
+    std::uint64_t dropped_stitches{};
+    double seconds_saved{};     // job_seconds without the filter less with it
+};
+
+// On-disk cache of parsed and planned designs.
+//
+// Entries are keyed by a hash of the PES bytes and placement of every
+// design of the job together with everything else the plan depends on:
+// the constants in machine.h, the speed step and version of the planner,
+// the plan_options and the layout version of the entries. When any of them
+// changes the old entries are simply not found any more.
+//
+// An entry holds the arrays of every stitch_list as they are in memory, so
+// a hit maps the file and copies the arrays without decoding anything.
+// Values are native endian, entries are not meant to be shared between
+// machines.
+//
+// Loading an entry marks it as used. Every store evicts the entries used
+// longest ago until the directory holds at most max_bytes of them.
+//
+//   offset  size  content
+//   0       8     "EMBOTPC3"
+//   8       8     hash (plan_key)
+//   16      8     source size (plan_key)
+//   24      4     CRC-32 (plan_key)
+//   28      4     0
+//   32      8     dropped stitches (plan_report)
+//   40      8     seconds saved (plan_report, double)
+//   48      16    min_x, max_x, min_y, max_y (int32)
+//   64      4     number of colors c
+//   68      4     number of blocks
+//   72      c     color indices, padded to a multiple of 8
+//
+// followed by every block:
+//
+//   0       4     color index
+//   4       4     number of stitches n
+//   8       8*w   jump words, w = (n + 63) / 64
+//           2*n   x, then y, then speed, padded to a multiple of 8
+class plan_cache
+{
+public:
+    static constexpr std::uintmax_t default_max_bytes = 256 << 20;
+
+    explicit plan_cache(std::filesystem::path dir, std::uintmax_t max_bytes = default_max_bytes);
+
+    // $XDG_CACHE_HOME/embot or ~/.cache/embot
+    static std::filesystem::path default_dir();
+
+    static plan_key key(const std::vector<design_file> &designs, const plan_options &options = {});
+
+    // The planned design or nothing if there is no valid entry, an entry
+    // that can't be read is no valid entry either. Fills `report` on a hit.
+    std::optional<pes> load(const plan_key &key, plan_report *report = nullptr) const;
+
+    // Creates the directory if needed, false if the entry could not be written.
+    bool store(const plan_key &key, const pes &pattern, const plan_report &report = {}) const;
+
+    // The designs parsed, composed (see compose), filtered (see
+    // filter_stitches) and planned, without the cache.
+    static pes plan(const std::vector<design_file> &designs, const plan_options &options = {},
+                    plan_report *report = nullptr);
+
+    // The planned job from the cache, or planned and stored.
+    pes load_or_plan(const std::vector<design_file> &designs, const plan_options &options = {},
+                     plan_report *report = nullptr) const;
+
+private:
+    std::filesystem::path entry(const plan_key &key) const;
+    void evict() const;
+
+    std::filesystem::path dir_;
+    std::uintmax_t max_bytes_;
+};
+
+#endif /* PLAN_CACHE_H */
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include "planner.h"
+#include "machine.h"
+
+// Seconds the hoop needs to move `mm` on one axis, speeding up as fast as
+// it can and stopping at the end.
+static double hoop_travel_time(double mm)
+{
+    double v = hoop_max_velocity, a = hoop_max_acceleration;
+    if (mm <= v * v / a)
+        return 2 * std::sqrt(mm / a);   // max velocity is never reached
+    return mm / v + v / a;
+}
+
+// hoop_travel_time of every distance up to 204.7 mm, the longest PEC stitch
+static const auto hoop_travel_times = [] {
+    std::array<double, 2048> table{};
+    for (std::size_t d = 1; d < table.size(); d++)
+        table[d] = hoop_travel_time(d / 10.0);
+    return table;
+}();
+
+// hoop_speed_limit of the same distances
+static const auto hoop_speed_limits = [] {
+    std::array<std::uint16_t, 2048> table{};
+    table[0] = max_speed;
+    for (std::size_t d = 1; d < table.size(); d++)
+    {
+        double speed = ticks_hoop_moving / (ticks_per_second_per_speed * hoop_travel_times[d]);
+        table[d] = std::uint16_t(std::clamp(int(speed), speed_ramp_step, max_speed));
+    }
+    return table;
+}();
+
+int hoop_speed_limit(int distance)
+{
+    return hoop_speed_limits[std::min(std::size_t(distance), hoop_speed_limits.size() - 1)];
+}
+
+int hoop_moving_ticks(int distance, int speed)
+{
+    auto seconds = std::size_t(distance) < hoop_travel_times.size() ? hoop_travel_times[distance]
+                                                                    : hoop_travel_time(distance / 10.0);
+    return int(std::ceil(seconds * speed * ticks_per_second_per_speed));
+}
+
+// Precalculate speed for each stitch
+// Ramp up speed after- and down before slow stitches
+//
+// This is how it should look around every slow stitch:
+//
+// ____       ____  max speed
+//     \     /
+//      \   /
+//       \-/        limit of the slow stitch
+//
+// Where ramps overlap the lowest one counts. The forward pass ramps up
+// from every limit, the backward pass down to it, which is O(n) however
+// dense the slow stitches are.
+void calc_speed(pes &pattern, bool hoop_model)
+{
+    for (auto &block : pattern.blocks)
+    {
+        auto &stitches = block.stitches;
+        auto n = stitches.size();
+        if (n == 0)
+            continue;
+
+        // We treat the first and last stitch as if it were a jump stitch.
+        // In this cases we need low speed.
+        stitches.set_jump(0, true);
+        stitches.set_jump(n - 1, true);
+
+        // The limits first, so the passes are nothing but a chain of min
+        stitches.set_speed(0, speed_ramp_step);
+        for (std::size_t idx = 1; idx < n; ++idx)
+        {
+            auto limit = max_speed;
+            if (hoop_model)
+                limit = hoop_speed_limit(std::max(std::abs(stitches.x(idx) - stitches.x(idx - 1)),
+                                                  std::abs(stitches.y(idx) - stitches.y(idx - 1))));
+            // Without a branch, jump stitches come in no predictable order.
+            stitches.set_speed(idx, limit - stitches.jump(idx) * (limit - speed_ramp_step));
+        }
+
+        int speed = speed_ramp_step;
+        for (std::size_t idx = 1; idx < n; ++idx)
+        {
+            speed = std::min(stitches.speed(idx), speed + speed_ramp_step);
+            stitches.set_speed(idx, speed);
+        }
+
+        for (std::size_t idx = n - 1; idx-- > 0;)
+        {
+            speed = std::min(stitches.speed(idx), speed + speed_ramp_step);
+            stitches.set_speed(idx, speed);
+        }
+    }
+}
+
+double job_seconds(const pes &pattern)
+{
+    double per_speed = 0;
+    for (auto &block : pattern.blocks)
+    {
+        for (std::size_t idx = 0; idx < block.stitches.size(); ++idx)
+            per_speed += 1.0 / std::max(1, block.stitches.speed(idx));
+    }
+    return per_speed * ticks_per_stitch / ticks_per_second_per_speed;
+}
+
+void speed_planner::push(const stitch &s)
+{
+    at(count_) = s;
+    if (new_block_)
+    {
+        at(count_).jumpstitch = jump_stitch;
+        new_block_ = false;
+        block_ended_ = false;
+    }
+    if (at(count_).jumpstitch)
+        limit(count_) = speed_ramp_step;
+    else if (hoop_model_)
+        limit(count_) = hoop_speed_limit(std::max(std::abs(s.x - last_x_), std::abs(s.y - last_y_)));
+    else
+        limit(count_) = max_speed;
+    last_x_ = s.x;
+    last_y_ = s.y;
+    count_++;
+}
+
+void speed_planner::end_block()
+{
+    if (count_ > 0)
+    {
+        at(count_ - 1).jumpstitch = jump_stitch;
+        limit(count_ - 1) = speed_ramp_step;
+    }
+    new_block_ = true;
+    block_ended_ = true;
+}
+
+bool speed_planner::pop(stitch &s)
+{
+    if (count_ == 0 || (count_ <= lookahead && !block_ended_))
+        return false;
+
+    s = at(0);
+    // Up from the stitch before, down to every limit ahead
+    auto speed = std::min(limit(0), last_speed_ + speed_ramp_step);
+    for (std::size_t i = 1; i < count_ && i <= lookahead; i++)
+        speed = std::min(speed, limit(i) + int(speed_ramp_step * i));
+    s.speed = speed;
+
+    last_speed_ = speed;
+    head_ = (head_ + 1) % capacity;
+    count_--;
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <array>
+#include <cstddef>
+
+#include "machine.h"
+#include "pes.h"
+
+// Speed of jump stitches and the most the speed changes from one stitch
+// to the next.
+constexpr int speed_ramp_step = 100;
+
+// Bumped whenever the planner plans different speeds for the same design,
+// which invalidates cached plans.
+constexpr int planner_version = 4;
+
+// Highest speed at which the hoop covers `distance` (in 1/10 mm, on the
+// axis that moves furthest) within the ticks_hoop_moving part of a stitch,
+// between speed_ramp_step and max_speed.
+int hoop_speed_limit(int distance);
+
+// Ticks the needle motor turns at `speed` while the hoop covers `distance`.
+// The rest of the stitch up to ticks_per_stitch is the part where the hoop
+// stands still. More than ticks_hoop_moving means the hoop can't cover the
+// distance at that speed before the needle comes down.
+int hoop_moving_ticks(int distance, int speed);
+
+// Precalculates the speed of every stitch.
+//
+// Jump stitches are limited to speed_ramp_step, the others to max_speed or,
+// with `hoop_model`, to hoop_speed_limit of the distance from the stitch
+// before them. The speed then changes by at most speed_ramp_step from one
+// stitch to the next, so it ramps down before and up after every slow
+// stitch. The ramp is per stitch, whatever their length; the hoop model
+// only enters through the time each single move of the hoop takes.
+void calc_speed(pes &pattern, bool hoop_model = false);
+
+// Seconds the needle motor turns for all stitches of a planned design.
+double job_seconds(const pes &pattern);
+
+// Plans the same speeds as calc_speed while the stitches stream in.
+//
+// No stitch is slower than speed_ramp_step, so the speed of a stitch only
+// depends on the stitches at most `lookahead` stitches after it and on the
+// speed planned for the one before. The planner holds back that many
+// stitches and never more. Like calc_speed it treats the first and the
+// last stitch of a block as jump stitches.
+//
+// Push the stitches of a block, taking every planned stitch with `pop`
+// before pushing the next one, and call `end_block` after the last one.
+// The next block may start once `pop` returned all stitches of the last.
+class speed_planner
+{
+public:
+    // Stitches after which the speed ramp from the slowest stitch reaches max_speed.
+    static constexpr std::size_t lookahead = (max_speed - 1) / speed_ramp_step;
+
+    // `hoop_model` like for calc_speed
+    explicit speed_planner(bool hoop_model = false) : hoop_model_(hoop_model) {}
+
+    void push(const stitch &s);
+    void end_block();
+
+    // Takes the next planned stitch, false if more stitches are needed.
+    bool pop(stitch &s);
+
+private:
+    static constexpr std::size_t capacity = 16;
+
+    stitch &at(std::size_t i) { return pending_[(head_ + i) % capacity]; }
+    int &limit(std::size_t i) { return limits_[(head_ + i) % capacity]; }
+
+    std::array<stitch, capacity> pending_;
+    std::array<int, capacity> limits_;  // speed limit of every pending stitch
+    std::size_t head_{}, count_{};
+    bool hoop_model_;
+    bool new_block_{true};
+    bool block_ended_{};
+    int last_x_{}, last_y_{};           // position of the last stitch pushed
+    int last_speed_{max_speed};         // speed of the last stitch popped
+};
+
+#endif /* PLANNER_H */
@@ -0,0 +1,206 @@
+#include <array>
+#include <cmath>
+#include <cstdlib>
+
+#include <fmt/core.h>
+
+#include "protocol.h"
+
+static constexpr std::array<std::uint16_t, 256> make_crc_table()
+{
+    std::array<std::uint16_t, 256> table{};
+    for (int i = 0; i < 256; i++)
+    {
+        std::uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr auto crc_table = make_crc_table();
+
+std::uint16_t crc16(const unsigned char *data, std::size_t size)
+{
+    std::uint16_t crc = 0xFFFF;
+    for (std::size_t i = 0; i < size; i++)
+        crc = (crc << 8) ^ crc_table[(crc >> 8) ^ data[i]];
+    return crc;
+}
+
+static void put_le16(unsigned char *p, int val)
+{
+    p[0] = val & 0xFF;
+    p[1] = (val >> 8) & 0xFF;
+}
+
+static int get_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+bool supports_binary_frames(const std::string &handshake_reply)
+{
+    return handshake_reply.find(binary_frames_tag) != std::string::npos;
+}
+
+bool supports_stitch_frames(const std::string &handshake_reply)
+{
+    return handshake_reply.find(stitch_frames_tag) != std::string::npos;
+}
+
+std::string ascii_move(const move_command &cmd)
+{
+    return fmt::format(">m{};{};{};{};", cmd.x / 10.0f, cmd.y / 10.0f, cmd.mot, cmd.speed);
+}
+
+void encode_move_frame(const move_command &cmd, std::uint8_t seq, unsigned char *frame)
+{
+    frame[0] = frame_sync;
+    frame[1] = frame_type_move;
+    frame[2] = seq;
+    put_le16(frame + 3, cmd.x);
+    put_le16(frame + 5, cmd.y);
+    put_le16(frame + 7, cmd.mot);
+    put_le16(frame + 9, cmd.speed);
+    put_le16(frame + 11, crc16(frame, move_frame_size - 2));
+}
+
+std::size_t encode_stitch_frame(const stitch_command *cmds, std::size_t count, std::uint8_t seq, unsigned char *frame)
+{
+    frame[0] = frame_sync;
+    frame[1] = frame_type_stitches;
+    frame[2] = seq;
+    frame[3] = count;
+    unsigned char *p = frame + 4;
+    for (std::size_t i = 0; i < count; i++, p += 10)
+    {
+        put_le16(p, cmds[i].x);
+        put_le16(p + 2, cmds[i].y);
+        put_le16(p + 4, cmds[i].moving);
+        put_le16(p + 6, cmds[i].stationary);
+        put_le16(p + 8, cmds[i].speed);
+    }
+    put_le16(p, crc16(frame, p - frame));
+    return stitch_frame_size(count);
+}
+
+command_decoder::result command_decoder::push(unsigned char byte)
+{
+    // Wait for the start of a command, everything else is line noise.
+    if (len == 0 && byte != '>' && byte != frame_sync)
+        return none;
+
+    buf[len++] = byte;
+
+    if (buf[0] == frame_sync)
+    {
+        std::size_t size = frame_size();
+        if (size == 0)
+        {
+            len = 0;
+            return bad_frame;
+        }
+        return len == size ? parse_frame() : none;
+    }
+
+    if (len < 2)
+        return none;
+    switch (buf[1])
+    {
+    case 'e':
+        len = 0;
+        return enable;
+    case 'd':
+        len = 0;
+        return disable;
+    case 'm':
+        if (byte == ';')
+        {
+            int fields = 0;
+            for (std::size_t i = 2; i < len; i++)
+                fields += buf[i] == ';';
+            if (fields == 4)
+                return parse_ascii_move();
+        }
+        if (len == max_command_size)
+        {
+            len = 0;
+            return bad_frame;
+        }
+        return none;
+    default:
+        len = 0;
+        return bad_frame;
+    }
+}
+
+command_decoder::result command_decoder::parse_ascii_move()
+{
+    // Terminate the buffer for strtof, the last ';' is not needed anymore.
+    buf[len - 1] = 0;
+    len = 0;
+
+    float val[4];
+    const char *p = reinterpret_cast<const char *>(buf + 2);
+    for (int i = 0; i < 4; i++)
+    {
+        char *end;
+        val[i] = std::strtof(p, &end);
+        if (end == p || (i < 3 && *end != ';'))
+            return bad_frame;
+        p = end + 1;
+    }
+    cmd.x = int(std::lround(val[0] * 10));
+    cmd.y = int(std::lround(val[1] * 10));
+    cmd.mot = int(val[2]);
+    cmd.speed = int(val[3]);
+    binary = false;
+    return move;
+}
+
+// Size of the frame in `buf` as far as it is known yet, 0 if it is invalid.
+std::size_t command_decoder::frame_size() const
+{
+    if (len < 2)
+        return move_frame_size;
+    if (buf[1] == frame_type_move)
+        return move_frame_size;
+    if (buf[1] != frame_type_stitches)
+        return 0;
+    if (len < 4)
+        return stitch_frame_size(1);
+    if (buf[3] < 1 || buf[3] > max_stitches_per_frame)
+        return 0;
+    return stitch_frame_size(buf[3]);
+}
+
+command_decoder::result command_decoder::parse_frame()
+{
+    std::size_t size = len;
+    len = 0;
+    if (crc16(buf, size - 2) != get_le16(buf + size - 2))
+        return bad_frame;
+    seq = buf[2];
+    binary = true;
+    if (buf[1] == frame_type_stitches)
+    {
+        stitch_count = buf[3];
+        const unsigned char *p = buf + 4;
+        for (std::size_t i = 0; i < stitch_count; i++, p += 10)
+        {
+            stitch_cmds[i].x = std::int16_t(get_le16(p));
+            stitch_cmds[i].y = std::int16_t(get_le16(p + 2));
+            stitch_cmds[i].moving = get_le16(p + 4);
+            stitch_cmds[i].stationary = get_le16(p + 6);
+            stitch_cmds[i].speed = get_le16(p + 8);
+        }
+        return stitches;
+    }
+    cmd.x = std::int16_t(get_le16(buf + 3));
+    cmd.y = std::int16_t(get_le16(buf + 5));
+    cmd.mot = get_le16(buf + 7);
+    cmd.speed = get_le16(buf + 9);
+    return move;
+}
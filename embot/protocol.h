@@ -0,0 +1,115 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Commands understood by the embot firmware.
+//
+// The original ASCII protocol:
+//
+//   >e                          enable the machine, answered with one byte
+//   >m{x};{y};{mot};{speed};    move the hoop to x/y (in mm) while the needle
+//                               motor turns `mot` ticks with `speed`
+//   >d                          disable the machine, answered with one byte
+//
+// Firmware which answers `>e` with a reply containing `binary_frames_tag`
+// additionally accepts the fixed size binary move frame below. Since the
+// first byte of a frame is `frame_sync` and never '>', both kinds of
+// commands can be mixed on the same link and old firmware never sees a frame.
+//
+//   offset  size  content
+//   0       1     frame_sync
+//   1       1     frame type ('m')
+//   2       1     sequence number, wraps around
+//   3       2     x in 1/10 mm
+//   5       2     y in 1/10 mm
+//   7       2     mot, ticks of the needle motor
+//   9       2     speed
+//   11      2     CRC-16/CCITT-FALSE over bytes 0 to 10
+//
+// All values are little endian, x and y are signed, the others unsigned.
+// Every frame is answered exactly like an ASCII `>m`. A frame with a wrong
+// CRC is dropped and answered with `reply_rejected`.
+//
+// Firmware which also announces `stitch_frames_tag` accepts stitch frames.
+// One stitch frame carries `count` complete needle cycles and is answered
+// with one reply for the whole frame. Each needle cycle is the same as two
+// `>m` commands to the same position: the first one turns the needle motor
+// `moving` ticks while the hoop moves, the second one `stationary` ticks
+// while the hoop stands still.
+//
+//   offset  size  content
+//   0       1     frame_sync
+//   1       1     frame type ('s')
+//   2       1     sequence number, shared with the move frames
+//   3       1     count, 1 to max_stitches_per_frame
+//   4       10*n  count times: x, y, moving, stationary, speed (2 bytes each)
+//   4+10*n  2     CRC-16/CCITT-FALSE over all previous bytes
+
+constexpr unsigned char frame_sync = 0xA5;
+constexpr unsigned char frame_type_move = 'm';
+constexpr unsigned char frame_type_stitches = 's';
+constexpr std::size_t move_frame_size = 13;
+constexpr std::size_t max_stitches_per_frame = 16;
+constexpr std::size_t stitch_frame_size(std::size_t count) { return 4 + 10 * count + 2; }
+constexpr std::size_t max_command_size = stitch_frame_size(max_stitches_per_frame);
+constexpr char reply_busy = '!';
+constexpr char reply_rejected = '?';
+const std::string binary_frames_tag = "+b1";
+const std::string stitch_frames_tag = "+s1";
+
+// One hoop move, x and y are in 1/10 mm (the unit of the PES file).
+struct move_command {
+    int x{}, y{}, mot{}, speed{};
+};
+
+// One needle cycle, x and y are in 1/10 mm.
+struct stitch_command {
+    int x{}, y{}, moving{}, stationary{}, speed{};
+};
+
+std::uint16_t crc16(const unsigned char *data, std::size_t size);
+
+/* Host side */
+bool supports_binary_frames(const std::string &handshake_reply);
+bool supports_stitch_frames(const std::string &handshake_reply);
+std::string ascii_move(const move_command &cmd);
+void encode_move_frame(const move_command &cmd, std::uint8_t seq, unsigned char *frame);
+// Returns the size of the frame, `frame` has to hold stitch_frame_size(count).
+std::size_t encode_stitch_frame(const stitch_command *cmds, std::size_t count, std::uint8_t seq, unsigned char *frame);
+
+/* Firmware side */
+
+// Reference decoder for the firmware side. It is fed the received bytes one
+// at a time and accepts ASCII commands as well as binary frames.
+// It does not allocate, so it can be used as a model for the firmware.
+struct command_decoder {
+    enum result {
+        none,      // more bytes needed
+        enable,    // >e
+        disable,   // >d
+        move,      // >m or a binary move frame, see `cmd`
+        stitches,  // stitch frame, see `stitch_cmds` and `stitch_count`
+        bad_frame, // CRC or format error, the command was dropped
+    };
+
+    result push(unsigned char byte);
+
+    move_command cmd;
+    stitch_command stitch_cmds[max_stitches_per_frame];
+    std::size_t stitch_count{};
+    std::uint8_t seq{};      // sequence number of the last binary frame
+    bool binary{};           // whether the last move was a binary frame
+
+private:
+    result parse_ascii_move();
+    result parse_frame();
+    std::size_t frame_size() const;
+
+    unsigned char buf[max_command_size];
+    std::size_t len{};
+};
+
+#endif /* PROTOCOL_H */
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "sender.h"
+#include "protocol.h"
+#include "trace.h"
+
+static_assert(max_command_size <= max_write_size, "a command has to fit into one write");
+
+void wait_output_queue(serial::Serial &ser, std::size_t watermark, int timeout_ms)
+{
+    auto deadline = command_link::clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::size_t queued;
+    while ((queued = ser.outputQueued()) > watermark)
+    {
+        if (command_link::clock::now() >= deadline)
+            throw std::runtime_error("timeout while waiting for the port to send its output queue");
+        ser.waitByteTimes(queued - watermark);
+    }
+}
+
+void write_all(serial::Serial &ser, const unsigned char *data, std::size_t size, int timeout_ms)
+{
+    auto deadline = command_link::clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true)
+    {
+        auto n = ser.write(data, size);
+        data += n;
+        size -= n;
+        if (size == 0)
+            return;
+        if (command_link::clock::now() >= deadline)
+            throw std::runtime_error("timeout while writing to the port");
+        // The queue is full, give the port the time to send some of it.
+        ser.waitByteTimes(std::min(size, max_write_size));
+    }
+}
+
+void command_link::set_output_watermark(std::size_t bytes)
+{
+    if (bytes > max_output_watermark)
+        throw std::invalid_argument("the output watermark must not be larger than " + std::to_string(max_output_watermark));
+    output_watermark_ = bytes;
+}
+
+command_sender::command_sender(serial::Serial &ser, int window, int timeout_ms, std::ostream *log)
+    : ser_(ser), window_(window), timeout_ms_(timeout_ms), log_(log)
+{
+    if (window_ < 1)
+        throw std::invalid_argument("window has to be at least 1");
+    sent_at_.resize(window_);
+}
+
+void command_sender::send(const unsigned char *cmmd, std::size_t size)
+{
+    while (busy_ || int(in_flight_) >= window_)
+        receive();
+
+    {
+        EMBOT_TRACE_SCOPE(trace_phase::flush, commands_);
+        wait_output_queue(ser_, output_watermark_, timeout_ms_);
+    }
+    {
+        EMBOT_TRACE_SCOPE(trace_phase::write, commands_);
+        write_all(ser_, cmmd, size, timeout_ms_);
+    }
+    sent(1);
+}
+
+void command_sender::send_run(const unsigned char *data, const std::uint32_t *offsets, std::size_t count)
+{
+    while (count > 0)
+    {
+        while (busy_ || int(in_flight_) >= window_)
+            receive();
+
+        // The commands are contiguous, so everything that fits into the
+        // window and into the output queue is one plain write.
+        auto n = std::min(count, std::size_t(window_) - in_flight_);
+        while (n > 1 && offsets[n] - offsets[0] > max_write_size)
+            n--;
+        {
+            EMBOT_TRACE_SCOPE(trace_phase::flush, commands_, n);
+            wait_output_queue(ser_, output_watermark_, timeout_ms_);
+        }
+        {
+            EMBOT_TRACE_SCOPE(trace_phase::write, commands_, n);
+            write_all(ser_, data + offsets[0], offsets[n] - offsets[0], timeout_ms_);
+        }
+        sent(n);
+        offsets += n;
+        count -= n;
+    }
+}
+
+void command_sender::drain()
+{
+    ser_.flush();
+    while (in_flight_ > 0)
+        receive();
+}
+
+void command_sender::sent(std::size_t count)
+{
+    auto now = clock::now();
+    for (std::size_t i = 0; i < count; i++)
+        sent_at_[(oldest_ + in_flight_++) % sent_at_.size()] = now;
+    commands_ += count;
+}
+
+std::string command_sender::read_reply()
+{
+    wait_readable();
+    return ser_.read(ser_.available());
+}
+
+// Processes all replies that are available, at least one.
+void command_sender::receive()
+{
+    unsigned char replies[256];
+    {
+        EMBOT_TRACE_SCOPE(trace_phase::wait, commands_ - in_flight_);
+        wait_readable();
+    }
+    auto n = ser_.read(replies, std::min(ser_.available(), sizeof(replies)));
+    auto now = clock::now();
+    for (std::size_t i = 0; i < n; i++)
+    {
+        auto x = char(replies[i]);
+        if (log_)
+            *log_ << (x) << "\n";
+
+        // The firmware is busy, the reply for the oldest command follows later.
+        if (x == reply_busy)
+        {
+            busy_ = true;
+            continue;
+        }
+        if (x == reply_rejected)
+            throw std::runtime_error("the firmware rejected a command");
+        busy_ = false;
+        if (in_flight_ > 0)
+        {
+            if (latencies_)
+                latencies_->push_back(now - sent_at_[oldest_]);
+            EMBOT_TRACE_RECORD(trace_phase::ack, sent_at_[oldest_], now, commands_ - in_flight_);
+            oldest_ = (oldest_ + 1) % sent_at_.size();
+            in_flight_--;
+        }
+    }
+}
+
+void command_sender::wait_readable()
+{
+    auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms_);
+    while (ser_.available() < 1)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        if (remaining <= 0)
+            throw std::runtime_error("timeout while waiting for a reply of the firmware");
+        // Returns early on interruption, availability is checked again anyway.
+        ser_.waitReadable(uint32_t(remaining));
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef SENDER_H
+#define SENDER_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "serial/serial.h"
+
+// Bytes that may wait in the output queue of the port before the senders
+// hold back further commands.
+constexpr std::size_t default_output_watermark = 1024;
+
+// The smallest output queue of a serial driver the senders count on. The
+// watermark plus one write never exceed it, so a write is rarely cut short
+// because the queue is full. The size is a guess, not a measured value,
+// drivers don't tell how large their queue is. If it is smaller, writes
+// are cut short more often and write_all waits for the port, nothing is lost.
+constexpr std::size_t output_queue_size = 4096;
+constexpr std::size_t max_output_watermark = output_queue_size / 2;
+// Runs of commands longer than this are split into several writes.
+constexpr std::size_t max_write_size = output_queue_size - max_output_watermark;
+
+// Blocks until at most `watermark` bytes are left in the output queue of
+// the port. Keeps the driver busy without letting the queue grow unbounded
+// and without waiting for it to run empty like Serial::flush does.
+// Throws std::runtime_error if the queue is still above the watermark
+// after `timeout_ms`, e.g. because flow control holds the port.
+void wait_output_queue(serial::Serial &ser, std::size_t watermark, int timeout_ms);
+
+// Writes all `size` bytes. Serial::write returns early when the output
+// queue is full, the rest is written once the port sent some of it.
+// Throws std::runtime_error if not everything is written after `timeout_ms`.
+void write_all(serial::Serial &ser, const unsigned char *data, std::size_t size, int timeout_ms);
+
+// Something commands can be sent to. Commands are opaque byte strings, see
+// protocol.h for what they look like.
+class command_link
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    virtual ~command_link() = default;
+
+    // Blocks until the command can be sent.
+    virtual void send(const unsigned char *cmmd, std::size_t size) = 0;
+    void send(const std::string &cmmd)
+    {
+        send(reinterpret_cast<const unsigned char *>(cmmd.data()), cmmd.size());
+    }
+
+    // Sends `count` commands that lie back to back in memory, command i is
+    // the slice from data + offsets[i] to data + offsets[i + 1].
+    virtual void send_run(const unsigned char *data, const std::uint32_t *offsets, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+            send(data + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    // Blocks until every command sent has been answered.
+    virtual void drain() = 0;
+
+    // Time from writing each command until its final reply is appended to
+    // `latencies`, null stops recording.
+    void record_latencies(std::vector<clock::duration> *latencies) { latencies_ = latencies; }
+
+    // Commands are written as soon as no more than `bytes` are waiting in
+    // the output queue of the port. The port is never drained per command.
+    // Throws std::invalid_argument above max_output_watermark.
+    void set_output_watermark(std::size_t bytes);
+
+protected:
+    std::vector<clock::duration> *latencies_{};
+    std::size_t output_watermark_{default_output_watermark};
+};
+
+// Sends commands to the embot firmware and matches them to the replies.
+// Replies arrive in the same order as the commands were sent, so the oldest
+// command in flight is the one that gets answered next.
+//
+// Up to `window` commands are kept in flight, i.e. written to the port
+// before their reply arrived. A window of 1 is the classic stop-and-wait
+// behavior: every command waits for its reply before the next one is sent.
+// The window must not be larger than the command buffer of the firmware.
+//
+// Every command is answered with one byte. If the firmware answers with '!'
+// its buffer is full and the real reply follows as soon as there is room
+// again. Nothing is sent while the firmware is busy. A command the firmware
+// could not decode is answered with '?' and aborts the job.
+//
+// Waiting for replies blocks in the kernel until the port becomes readable.
+// If no reply arrives within `timeout_ms` a std::runtime_error is thrown.
+//
+// Every reply is echoed to `log` unless it is null.
+class command_sender : public command_link
+{
+public:
+    command_sender(serial::Serial &ser, int window = 1, int timeout_ms = 30000, std::ostream *log = nullptr);
+
+    using command_link::send;
+
+    // Blocks until there is room in the window and writes the command.
+    void send(const unsigned char *cmmd, std::size_t size) override;
+
+    // Writes as many of the commands as fit into the window at once.
+    void send_run(const unsigned char *data, const std::uint32_t *offsets, std::size_t count) override;
+
+    // Drains the port and blocks until every command in flight has been
+    // answered.
+    void drain() override;
+
+    // Blocks until the port is readable and returns everything available.
+    // Used for replies which are not part of the command window like the
+    // ones of `>e` and `>d`.
+    std::string read_reply();
+
+    int window() const { return window_; }
+
+private:
+    void receive();
+    void wait_readable();
+    void sent(std::size_t count);
+
+    serial::Serial &ser_;
+    int window_;
+    int timeout_ms_;
+    std::ostream *log_;
+    bool busy_{};
+    // When each command in flight was sent, a ring of `window` entries so
+    // sending never allocates.
+    std::vector<clock::time_point> sent_at_;
+    std::size_t oldest_{};
+    std::size_t in_flight_{};
+    std::size_t commands_{};                    // number of commands written
+};
+
+#endif /* SENDER_H */
@@ -0,0 +1,83 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+//
+// The producer fills a slot in place with `alloc` and publishes it with
+// `commit`, the consumer looks at the oldest slot with `front` and releases
+// it with `pop`. Neither side ever blocks, waiting for room or data is up to
+// the caller.
+template <typename T>
+class spsc_ring
+{
+public:
+    explicit spsc_ring(std::size_t capacity)
+        : mask_(capacity - 1), items_(new T[capacity])
+    {
+        if (capacity == 0 || (capacity & mask_) != 0)
+            throw std::invalid_argument("ring capacity has to be a power of two");
+    }
+
+    /* Producer */
+
+    // Returns the next free slot or null if the ring is full.
+    T *alloc()
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) > mask_)
+            return nullptr;
+        return &items_[head & mask_];
+    }
+
+    // Publishes the slot returned by the last `alloc`.
+    void commit()
+    {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool push(const T &item)
+    {
+        auto slot = alloc();
+        if (!slot)
+            return false;
+        *slot = item;
+        commit();
+        return true;
+    }
+
+    /* Consumer */
+
+    // Returns the oldest item or null if the ring is empty.
+    T *front()
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+            return nullptr;
+        return &items_[tail & mask_];
+    }
+
+    void pop()
+    {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    // Head and tail on separate cache lines, so producer and consumer do not
+    // invalidate each other's line on every access.
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+    const std::size_t mask_;
+    std::unique_ptr<T[]> items_;
+};
+
+#endif /* SPSC_RING_H */
@@ -0,0 +1,39 @@
+#include "stitch_filter.h"
+
+static long long squared_distance(const stitch &a, const stitch &b)
+{
+    long long dx = a.x - b.x, dy = a.y - b.y;
+    return dx * dx + dy * dy;
+}
+
+std::size_t filter_stitches(pes &pattern, int min_length)
+{
+    auto min_squared = (long long)min_length * min_length;
+    std::size_t dropped = 0;
+    for (auto &block : pattern.blocks)
+    {
+        auto &stitches = block.stitches;
+        auto n = stitches.size();
+        stitch_list kept;
+        kept.reserve(n);
+        std::size_t section_start = 0, section_end = 0;
+        for (std::size_t idx = 0; idx < n; idx++)
+        {
+            auto s = stitches[idx];
+            if (idx == 0 || s.jumpstitch)
+            {
+                section_start = idx;
+                section_end = idx;
+                while (section_end + 1 < n && !stitches.jump(section_end + 1))
+                    section_end++;
+            }
+            bool lock = idx - section_start < lock_stitches || section_end - idx < lock_stitches;
+            if (s.jumpstitch || lock || kept.empty() || squared_distance(kept.back(), s) >= min_squared)
+                kept.push_back(s);
+            else
+                dropped++;
+        }
+        stitches = std::move(kept);
+    }
+    return dropped;
+}
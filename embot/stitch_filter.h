@@ -0,0 +1,24 @@
+#ifndef STITCH_FILTER_H
+#define STITCH_FILTER_H
+
+#include <cstddef>
+
+#include "pes.h"
+
+// Stitches at the start and the end of a section that are never filtered,
+// they hold the tie-in and the tie-off.
+constexpr std::size_t lock_stitches = 4;
+
+// Drops stitches closer than `min_length` (in 1/10 mm) to the stitch kept
+// before them, so duplicate points disappear and runs of tiny stitches are
+// merged into stitches of at least that length. A `min_length` of 1 only
+// drops exact duplicates, 0 keeps everything.
+//
+// A section starts at the start of a block and at every jump stitch. Jump
+// stitches and the first and last lock_stitches stitches of every section
+// are always kept. Run it before calc_speed, which turns the last stitch of
+// every block into a jump and so would cut the tie-off from its section.
+// Returns the number of stitches dropped.
+std::size_t filter_stitches(pes &pattern, int min_length);
+
+#endif /* STITCH_FILTER_H */
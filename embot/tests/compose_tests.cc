@@ -0,0 +1,90 @@
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "compose.h"
+#include "test_patterns.h"
+
+TEST(ComposeTests, singleDesignAtOriginIsKept)
+{
+    auto stitches = run_at(5, 5, 4);
+    std::vector<placement> designs;
+    designs.push_back({make_pes({{5, stitches}, {20, run_at(40, 5)}})});
+    auto job = compose(std::move(designs));
+    ASSERT_EQ(2u, job.blocks.size());
+    EXPECT_EQ(5, pes_color_index(job.blocks[0].block_color));
+    ASSERT_EQ(stitches.size(), job.blocks[0].stitches.size());
+    for (std::size_t i = 0; i < stitches.size(); i++)
+    {
+        EXPECT_EQ(stitches[i].x, job.blocks[0].stitches.x(i));
+        EXPECT_EQ(stitches[i].jumpstitch != 0, job.blocks[0].stitches.jump(i) != 0);
+    }
+}
+
+TEST(ComposeTests, designsSideBySideShareColorChanges)
+{
+    std::vector<placement> designs;
+    designs.push_back({make_pes({{5, run_at(0, 0)}, {20, run_at(0, 10)}})});
+    designs.push_back({make_pes({{5, run_at(0, 0)}, {20, run_at(0, 10)}}), 1000, 0});
+    auto job = compose(std::move(designs));
+
+    ASSERT_EQ(2u, job.blocks.size());
+    ASSERT_EQ(2u, job.colors.size());
+    EXPECT_EQ(5, pes_color_index(job.blocks[0].block_color));
+    EXPECT_EQ(20, pes_color_index(job.blocks[1].block_color));
+    auto &first = job.blocks[0].stitches;
+    ASSERT_EQ(6u, first.size());
+    EXPECT_EQ(0, first.x(0));
+    EXPECT_EQ(1000, first.x(3));
+    EXPECT_TRUE(first.jump(3));
+    EXPECT_EQ(0, job.min_x);
+    EXPECT_EQ(1020, job.max_x);
+    EXPECT_EQ(0, job.min_y);
+    EXPECT_EQ(10, job.max_y);
+}
+
+TEST(ComposeTests, overlappingDesignWaitsForTheOneBelow)
+{
+    std::vector<placement> designs;
+    designs.push_back({make_pes({{5, run_at(0, 0)}, {20, run_at(0, 10)}})});
+    designs.push_back({make_pes({{20, run_at(0, 5)}})});
+    auto job = compose(std::move(designs));
+
+    ASSERT_EQ(3u, job.blocks.size());
+    EXPECT_EQ(5, pes_color_index(job.blocks[0].block_color));
+    EXPECT_EQ(20, pes_color_index(job.blocks[1].block_color));
+    EXPECT_EQ(20, pes_color_index(job.blocks[2].block_color));
+    EXPECT_EQ(10, job.blocks[1].stitches.y(0));
+    EXPECT_EQ(5, job.blocks[2].stitches.y(0));
+}
+
+TEST(ComposeTests, emptyDesignsAndBlocksAreDropped)
+{
+    std::vector<placement> designs;
+    designs.push_back({make_pes({{7, {}}})});
+    designs.push_back({make_pes({{5, run_at(0, 0)}, {20, {}}}), 100, 100});
+    auto job = compose(std::move(designs));
+    ASSERT_EQ(1u, job.blocks.size());
+    EXPECT_EQ(5, pes_color_index(job.blocks[0].block_color));
+    EXPECT_EQ(3u, job.blocks[0].stitches.size());
+
+    designs.clear();
+    designs.push_back({make_pes({{5, run_at(0, 0)}, {20, {}}})});
+    EXPECT_EQ(1u, compose(std::move(designs)).blocks.size());
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
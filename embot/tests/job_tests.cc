@@ -0,0 +1,132 @@
+#include <iostream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "job.h"
+#include "machine.h"
+#include "planner.h"
+#include "test_patterns.h"
+
+namespace
+{
+
+const wire_format stitch_frames{true, true, 8};
+
+// The needle cycles and traversals of a job compiled with stitch frames.
+std::vector<stitch_command> decoded_cycles(const compiled_job &job)
+{
+    std::vector<stitch_command> cycles;
+    command_decoder decoder;
+    for (std::size_t i = 0; i < job.commands(); i++)
+    {
+        auto r = command_decoder::none;
+        for (auto j = job.offsets[i]; j < job.offsets[i + 1]; j++)
+            r = decoder.push(job.bytes[j]);
+        EXPECT_EQ(command_decoder::stitches, r) << "command " << i;
+        cycles.insert(cycles.end(), decoder.stitch_cmds, decoder.stitch_cmds + decoder.stitch_count);
+    }
+    return cycles;
+}
+
+std::vector<stitch_command> planned_cycles(pes pattern, bool hoop_model)
+{
+    calc_speed(pattern, hoop_model);
+    return decoded_cycles(compile_job(pattern, stitch_frames, hoop_model));
+}
+
+} // namespace
+
+// A run with one stitch of 10 cm in the middle
+TEST(JobTests, needleCycleIsSplitAtTheHoopWindow)
+{
+    auto pattern = make_pes({{5, joined({run_at(0, 0, 5), {{1040, 0}, {1050, 0}, {1060, 0}, {1070, 0}}})}});
+    auto cycles = planned_cycles(pattern, false);
+    ASSERT_EQ(9u, cycles.size());
+    for (std::size_t i = 0; i < cycles.size(); i++)
+    {
+        EXPECT_EQ(ticks_per_stitch, cycles[i].moving + cycles[i].stationary) << "cycle " << i;
+        // The first and the last stitch are sewn like jumps
+        bool jump = i == 0 || i + 1 == cycles.size();
+        EXPECT_EQ(jump ? 0 : ticks_hoop_moving, cycles[i].moving) << "cycle " << i;
+    }
+}
+
+TEST(JobTests, longStitchIsSentAsJumpWithHoopModel)
+{
+    // Too far for the hoop within ticks_hoop_moving even at the lowest speed
+    ASSERT_GT(hoop_moving_ticks(1000, speed_ramp_step), ticks_hoop_moving);
+
+    auto pattern = make_pes({{5, joined({run_at(0, 0, 5), {{1040, 0}, {1050, 0}, {1060, 0}, {1070, 0}}})}});
+    auto cycles = planned_cycles(pattern, true);
+    ASSERT_EQ(9u, cycles.size());
+    EXPECT_EQ(1040, cycles[5].x);
+    EXPECT_EQ(speed_ramp_step, cycles[5].speed);
+    EXPECT_EQ(0, cycles[5].moving);
+    EXPECT_EQ(ticks_per_stitch, cycles[5].stationary);
+    for (std::size_t i = 1; i + 1 < cycles.size(); i++)
+    {
+        if (i != 5)
+        {
+            EXPECT_EQ(ticks_hoop_moving, cycles[i].moving) << "cycle " << i;
+        }
+    }
+
+    // Without the model the same stitch is sewn like any other
+    EXPECT_EQ(ticks_hoop_moving, planned_cycles(pattern, false)[5].moving);
+}
+
+TEST(JobTests, jumpChainIsOneMove)
+{
+    auto pattern = make_pes({{5, joined({run_at(0, 0), {{100, 0, jump_stitch}, {200, 0, jump_stitch}, {300, 50, jump_stitch},
+                                                       {310, 50}, {320, 50}, {330, 50}}})}});
+    auto cycles = planned_cycles(pattern, false);
+    const int xs[] = {0, 10, 20, 300, 310, 320, 330};
+    ASSERT_EQ(7u, cycles.size());
+    for (std::size_t i = 0; i < cycles.size(); i++)
+        EXPECT_EQ(xs[i], cycles[i].x) << "cycle " << i;
+    // Straight to the last jump stitch of the chain, where the needle cycles once
+    EXPECT_EQ(50, cycles[3].y);
+    EXPECT_EQ(0, cycles[3].moving);
+    EXPECT_EQ(ticks_per_stitch, cycles[3].stationary);
+}
+
+// 500 mm to the right, with the design starting left of the origin
+TEST(JobTests, longTraversalIsSplit)
+{
+    auto pattern = make_pes({{5, joined({run_at(-100, 0), {{4920, 30, jump_stitch}, {4930, 30}, {4940, 30}}})}});
+    auto cycles = planned_cycles(pattern, false);
+    ASSERT_EQ(8u, cycles.size());
+
+    // Three moves of at most max_hoop_travel, the last one is the needle
+    // cycle of the jump stitch.
+    for (std::size_t i = 3; i < 6; i++)
+    {
+        EXPECT_LE(cycles[i].x - cycles[i - 1].x, max_hoop_travel) << "cycle " << i;
+        EXPECT_GT(cycles[i].x, cycles[i - 1].x) << "cycle " << i;
+    }
+    for (std::size_t i = 3; i < 5; i++)
+    {
+        EXPECT_EQ(0, cycles[i].moving) << "cycle " << i;
+        EXPECT_EQ(0, cycles[i].stationary) << "cycle " << i;
+    }
+    EXPECT_EQ(5020, cycles[5].x);
+    EXPECT_EQ(30, cycles[5].y);
+    EXPECT_EQ(0, cycles[5].moving);
+    EXPECT_EQ(ticks_per_stitch, cycles[5].stationary);
+    EXPECT_EQ(5030, cycles[6].x);
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -0,0 +1,210 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "gtest/gtest.h"
+
+#include "plan_cache.h"
+#include "test_patterns.h"
+
+namespace
+{
+
+// A fresh cache directory for every test, removed afterwards.
+class PlanCacheTests : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        dir = std::filesystem::temp_directory_path() /
+              fmt::format("embot-plan-cache-test-{}-{}", getpid(),
+                          ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        std::filesystem::remove_all(dir);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    std::filesystem::path entry_path(const plan_key &key) const
+    {
+        return dir / fmt::format("{:016x}.plan", key.hash);
+    }
+
+    std::filesystem::path dir;
+};
+
+std::vector<unsigned char> design_bytes(int x)
+{
+    return pes_bytes({{5, joined({run_at(x, 0, 20), run_at(x + 500, 40, 20)})}, {20, run_at(x, 100, 30)}});
+}
+
+void expect_same_pattern(const pes &expected, const pes &actual)
+{
+    EXPECT_EQ(expected.min_x, actual.min_x);
+    EXPECT_EQ(expected.max_x, actual.max_x);
+    EXPECT_EQ(expected.min_y, actual.min_y);
+    EXPECT_EQ(expected.max_y, actual.max_y);
+    ASSERT_EQ(expected.colors.size(), actual.colors.size());
+    for (std::size_t i = 0; i < expected.colors.size(); i++)
+        EXPECT_EQ(pes_color_index(expected.colors[i]), pes_color_index(actual.colors[i]));
+    ASSERT_EQ(expected.blocks.size(), actual.blocks.size());
+    for (std::size_t b = 0; b < expected.blocks.size(); b++)
+    {
+        EXPECT_EQ(pes_color_index(expected.blocks[b].block_color), pes_color_index(actual.blocks[b].block_color));
+        auto &e = expected.blocks[b].stitches;
+        auto &a = actual.blocks[b].stitches;
+        ASSERT_EQ(e.size(), a.size()) << "block " << b;
+        for (std::size_t i = 0; i < e.size(); i++)
+        {
+            EXPECT_EQ(e.x(i), a.x(i)) << "block " << b << " stitch " << i;
+            EXPECT_EQ(e.y(i), a.y(i)) << "block " << b << " stitch " << i;
+            EXPECT_EQ(e.jump(i), a.jump(i)) << "block " << b << " stitch " << i;
+            EXPECT_EQ(e.speed(i), a.speed(i)) << "block " << b << " stitch " << i;
+        }
+    }
+}
+
+} // namespace
+
+TEST_F(PlanCacheTests, storeAndLoad)
+{
+    auto bytes = design_bytes(0);
+    std::vector<design_file> designs{{bytes}};
+    plan_options options;
+    options.drop_duplicates = true;
+    plan_cache cache(dir);
+
+    auto key = plan_cache::key(designs, options);
+    EXPECT_EQ(bytes.size(), key.source_size);
+    EXPECT_FALSE(cache.load(key));
+
+    plan_report report;
+    auto pattern = plan_cache::plan(designs, options, &report);
+    report.dropped_stitches = 3;
+    report.seconds_saved = 1.5;
+    ASSERT_TRUE(cache.store(key, pattern, report));
+
+    plan_report loaded_report;
+    auto loaded = cache.load(key, &loaded_report);
+    ASSERT_TRUE(loaded);
+    expect_same_pattern(pattern, *loaded);
+    EXPECT_EQ(3u, loaded_report.dropped_stitches);
+    EXPECT_EQ(1.5, loaded_report.seconds_saved);
+
+    // Another placement or other options are another entry
+    designs[0].x = 10;
+    EXPECT_FALSE(cache.load(plan_cache::key(designs, options)));
+    designs[0].x = 0;
+    EXPECT_FALSE(cache.load(plan_cache::key(designs)));
+    expect_same_pattern(pattern, cache.load_or_plan(designs, options));
+}
+
+// Only the hash names the entry, a job with the same hash and another
+// size or CRC does not get its plan.
+TEST_F(PlanCacheTests, collidingHashIsAMiss)
+{
+    auto bytes = design_bytes(0);
+    std::vector<design_file> designs{{bytes}};
+    plan_cache cache(dir);
+    auto key = plan_cache::key(designs);
+    ASSERT_TRUE(cache.store(key, plan_cache::plan(designs)));
+
+    auto other = key;
+    other.source_size++;
+    EXPECT_FALSE(cache.load(other));
+    other = key;
+    other.crc ^= 1;
+    EXPECT_FALSE(cache.load(other));
+    EXPECT_TRUE(cache.load(key));
+}
+
+TEST_F(PlanCacheTests, brokenEntriesAreMisses)
+{
+    auto bytes = design_bytes(0);
+    std::vector<design_file> designs{{bytes}};
+    plan_cache cache(dir);
+    auto key = plan_cache::key(designs);
+    ASSERT_TRUE(cache.store(key, plan_cache::plan(designs)));
+    auto path = entry_path(key);
+    auto size = std::filesystem::file_size(path);
+
+    // Cut off everywhere in the header and in the middle of the blocks
+    std::vector<char> whole(size);
+    std::ifstream(path, std::ios::binary).read(whole.data(), size);
+    for (std::uintmax_t cut = 0; cut < size; cut += cut < 96 ? 1 : 37)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(whole.data(), cut);
+        EXPECT_FALSE(cache.load(key)) << "cut to " << cut << " bytes";
+    }
+
+    // Something else than an entry file
+    std::filesystem::remove(path);
+    std::filesystem::create_directory(path);
+    EXPECT_FALSE(cache.load(key));
+    std::filesystem::remove(path);
+
+    // A miss is planned and stored again
+    std::ofstream(path, std::ios::binary) << "EMBOTPC0 garbage";
+    EXPECT_FALSE(cache.load(key));
+    cache.load_or_plan(designs);
+    EXPECT_TRUE(cache.load(key));
+}
+
+// Room for two entries, the one used longest ago goes
+TEST_F(PlanCacheTests, leastRecentlyUsedIsEvicted)
+{
+    std::vector<std::vector<unsigned char>> bytes{design_bytes(0), design_bytes(100), design_bytes(200)};
+    std::vector<plan_key> keys;
+    std::vector<pes> patterns;
+    for (auto &b : bytes)
+    {
+        keys.push_back(plan_cache::key({{b}}));
+        patterns.push_back(plan_cache::plan({{b}}));
+    }
+
+    plan_cache unlimited(dir);
+    ASSERT_TRUE(unlimited.store(keys[0], patterns[0]));
+    auto entry_size = std::filesystem::file_size(entry_path(keys[0]));
+    plan_cache cache(dir, entry_size * 5 / 2);
+
+    // Modification times are compared, give them time to differ
+    auto tick = [] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); };
+    tick();
+    ASSERT_TRUE(cache.store(keys[1], patterns[1]));
+    tick();
+    EXPECT_TRUE(cache.load(keys[0]));
+    tick();
+    ASSERT_TRUE(cache.store(keys[2], patterns[2]));
+
+    EXPECT_TRUE(std::filesystem::exists(entry_path(keys[0])));
+    EXPECT_FALSE(std::filesystem::exists(entry_path(keys[1])));
+    EXPECT_TRUE(std::filesystem::exists(entry_path(keys[2])));
+
+    // Nothing fits, every store evicts everything
+    plan_cache none(dir, 0);
+    tick();
+    EXPECT_TRUE(none.store(keys[1], patterns[1]));
+    EXPECT_FALSE(none.load(keys[0]));
+    EXPECT_FALSE(none.load(keys[1]));
+    EXPECT_FALSE(none.load(keys[2]));
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -0,0 +1,136 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "planner.h"
+#include "test_patterns.h"
+
+namespace
+{
+
+// Blocks of up to 400 stitches between 0 and 12 mm long with a jump every
+// few dozen stitches, so slow stitches lie closer than the lookahead.
+pes random_pattern(std::uint32_t seed)
+{
+    auto rnd = [&seed](int n) {
+        seed = seed * 1664525u + 1013904223u;
+        return int((seed >> 8) % unsigned(n));
+    };
+    std::vector<test_block> blocks;
+    int x = 0;
+    for (int b = 0; b < 6; b++)
+    {
+        blocks.push_back({(unsigned char)(b + 1), {}});
+        // Also blocks of a single stitch
+        auto n = b == 2 ? 1 : rnd(400);
+        for (int i = 0; i < n; i++)
+        {
+            x = rnd(8) == 0 ? x + rnd(1200) : x + rnd(40) - 20;
+            x = std::max(-30000, std::min(30000, x));
+            blocks.back().stitches.push_back({x, rnd(30), rnd(40) == 0 ? jump_stitch : normal_stitch});
+        }
+    }
+    return make_pes(blocks);
+}
+
+std::vector<stitch> streamed(const pes &pattern, bool hoop_model)
+{
+    std::vector<stitch> planned;
+    speed_planner planner(hoop_model);
+    stitch s;
+    for (auto &block : pattern.blocks)
+    {
+        for (auto st : block.stitches)
+        {
+            planner.push(st);
+            while (planner.pop(s))
+                planned.push_back(s);
+        }
+        planner.end_block();
+        while (planner.pop(s))
+            planned.push_back(s);
+    }
+    return planned;
+}
+
+void expect_same_plan(const pes &pattern, bool hoop_model)
+{
+    pes whole = pattern;
+    calc_speed(whole, hoop_model);
+    auto stream = streamed(pattern, hoop_model);
+
+    std::size_t idx = 0;
+    for (std::size_t b = 0; b < whole.blocks.size(); b++)
+    {
+        auto &stitches = whole.blocks[b].stitches;
+        for (std::size_t i = 0; i < stitches.size(); i++, idx++)
+        {
+            ASSERT_LT(idx, stream.size());
+            EXPECT_EQ(stitches.speed(i), stream[idx].speed) << "block " << b << " stitch " << i;
+            EXPECT_EQ(stitches.jump(i), stream[idx].jumpstitch != 0) << "block " << b << " stitch " << i;
+        }
+    }
+    EXPECT_EQ(idx, stream.size());
+}
+
+} // namespace
+
+TEST(PlannerTests, speedChangesByAtMostOneStep)
+{
+    auto pattern = random_pattern(3);
+    calc_speed(pattern, true);
+    for (auto &block : pattern.blocks)
+    {
+        auto &stitches = block.stitches;
+        for (std::size_t i = 0; i < stitches.size(); i++)
+        {
+            if (stitches.jump(i))
+            {
+                EXPECT_EQ(speed_ramp_step, stitches.speed(i)) << "stitch " << i;
+            }
+            EXPECT_LE(stitches.speed(i), max_speed);
+            if (i > 0)
+            {
+                EXPECT_LE(std::abs(stitches.speed(i) - stitches.speed(i - 1)), speed_ramp_step) << "stitch " << i;
+            }
+        }
+        if (!stitches.empty())
+        {
+            EXPECT_TRUE(stitches.jump(0));
+            EXPECT_TRUE(stitches.jump(stitches.size() - 1));
+        }
+    }
+}
+
+TEST(PlannerTests, streamedPlanMatchesWholeDesign)
+{
+    for (std::uint32_t seed = 1; seed <= 5; seed++)
+    {
+        expect_same_plan(random_pattern(seed), false);
+        expect_same_plan(random_pattern(seed), true);
+    }
+}
+
+TEST(PlannerTests, streamedPlanOfTinyBlocks)
+{
+    auto pattern = make_pes({{5, run_at(0, 0, 1)}, {6, run_at(0, 0, 2)}, {7, {}}, {8, run_at(0, 0, 30)}});
+    expect_same_plan(pattern, false);
+    expect_same_plan(pattern, true);
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
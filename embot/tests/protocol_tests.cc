@@ -0,0 +1,165 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "protocol.h"
+
+namespace
+{
+
+// Feeds the bytes one at a time, only the last one may complete a command.
+command_decoder::result feed(command_decoder &decoder, const unsigned char *data, std::size_t size)
+{
+    auto r = command_decoder::none;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        r = decoder.push(data[i]);
+        if (i + 1 < size)
+        {
+            EXPECT_EQ(command_decoder::none, r) << "at byte " << i;
+        }
+    }
+    return r;
+}
+
+command_decoder::result feed(command_decoder &decoder, const std::string &data)
+{
+    return feed(decoder, reinterpret_cast<const unsigned char *>(data.data()), data.size());
+}
+
+void expect_move_round_trip(const move_command &cmd, std::uint8_t seq)
+{
+    unsigned char frame[move_frame_size];
+    encode_move_frame(cmd, seq, frame);
+    command_decoder decoder;
+    ASSERT_EQ(command_decoder::move, feed(decoder, frame, sizeof(frame)));
+    EXPECT_TRUE(decoder.binary);
+    EXPECT_EQ(seq, decoder.seq);
+    EXPECT_EQ(cmd.x, decoder.cmd.x);
+    EXPECT_EQ(cmd.y, decoder.cmd.y);
+    EXPECT_EQ(cmd.mot, decoder.cmd.mot);
+    EXPECT_EQ(cmd.speed, decoder.cmd.speed);
+}
+
+void expect_stitches_round_trip(const stitch_command *cmds, std::size_t count, std::uint8_t seq)
+{
+    unsigned char frame[max_command_size];
+    auto size = encode_stitch_frame(cmds, count, seq, frame);
+    ASSERT_EQ(stitch_frame_size(count), size);
+    command_decoder decoder;
+    ASSERT_EQ(command_decoder::stitches, feed(decoder, frame, size));
+    EXPECT_TRUE(decoder.binary);
+    EXPECT_EQ(seq, decoder.seq);
+    ASSERT_EQ(count, decoder.stitch_count);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        EXPECT_EQ(cmds[i].x, decoder.stitch_cmds[i].x) << "stitch " << i;
+        EXPECT_EQ(cmds[i].y, decoder.stitch_cmds[i].y) << "stitch " << i;
+        EXPECT_EQ(cmds[i].moving, decoder.stitch_cmds[i].moving) << "stitch " << i;
+        EXPECT_EQ(cmds[i].stationary, decoder.stitch_cmds[i].stationary) << "stitch " << i;
+        EXPECT_EQ(cmds[i].speed, decoder.stitch_cmds[i].speed) << "stitch " << i;
+    }
+}
+
+} // namespace
+
+// The check value of CRC-16/CCITT-FALSE
+TEST(ProtocolTests, crc16CheckValue)
+{
+    const char data[] = "123456789";
+    EXPECT_EQ(0x29B1, crc16(reinterpret_cast<const unsigned char *>(data), 9));
+}
+
+TEST(ProtocolTests, moveFrameRoundTrip)
+{
+    expect_move_round_trip({123, -456, 2900, 60}, 0);
+    expect_move_round_trip({-1, 1, 0, 11600}, 255);
+}
+
+TEST(ProtocolTests, stitchFrameRoundTrip)
+{
+    const stitch_command one[] = {{10, 20, 2900, 8700, 60}};
+    expect_stitches_round_trip(one, 1, 7);
+
+    stitch_command full[max_stitches_per_frame];
+    for (std::size_t i = 0; i < max_stitches_per_frame; i++)
+        full[i] = {int(i) * 31 - 200, 500 - int(i) * 17, int(i) * 100, 11600 - int(i) * 100, 10 + int(i)};
+    expect_stitches_round_trip(full, max_stitches_per_frame, 200);
+}
+
+// x and y are signed 16 bit, the others unsigned 16 bit.
+TEST(ProtocolTests, int16EdgeValues)
+{
+    expect_move_round_trip({-32768, 32767, 0, 65535}, 1);
+    expect_move_round_trip({32767, -32768, 65535, 0}, 2);
+    expect_move_round_trip({0, -1, 32768, 1}, 3);
+
+    const stitch_command edges[] = {
+        {-32768, 32767, 0, 65535, 65535},
+        {32767, -32768, 65535, 0, 0},
+        {-1, 0, 32768, 32767, 1},
+    };
+    expect_stitches_round_trip(edges, 3, 4);
+}
+
+TEST(ProtocolTests, asciiMoveRoundTrip)
+{
+    command_decoder decoder;
+    ASSERT_EQ(command_decoder::move, feed(decoder, ascii_move({-123, 4567, 2900, 60})));
+    EXPECT_FALSE(decoder.binary);
+    EXPECT_EQ(-123, decoder.cmd.x);
+    EXPECT_EQ(4567, decoder.cmd.y);
+    EXPECT_EQ(2900, decoder.cmd.mot);
+    EXPECT_EQ(60, decoder.cmd.speed);
+}
+
+TEST(ProtocolTests, badCrcIsRejected)
+{
+    unsigned char frame[move_frame_size];
+    encode_move_frame({100, 200, 2900, 60}, 9, frame);
+    command_decoder decoder;
+
+    // Every single bit flip after the sync byte has to be caught
+    for (std::size_t byte = 1; byte < sizeof(frame); byte++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            unsigned char broken[move_frame_size];
+            std::memcpy(broken, frame, sizeof(frame));
+            broken[byte] ^= 1 << bit;
+            command_decoder::result r = command_decoder::none;
+            for (auto c : broken)
+            {
+                if ((r = decoder.push(c)) != command_decoder::none)
+                    break;
+            }
+            EXPECT_EQ(command_decoder::bad_frame, r) << "byte " << byte << " bit " << bit;
+        }
+    }
+
+    const stitch_command cmds[] = {{1, 2, 3, 4, 5}, {6, 7, 8, 9, 10}};
+    unsigned char stitch_frame[max_command_size];
+    auto size = encode_stitch_frame(cmds, 2, 10, stitch_frame);
+    stitch_frame[size - 1] ^= 0x80;
+    EXPECT_EQ(command_decoder::bad_frame, feed(decoder, stitch_frame, size));
+
+    // A rejected frame does not confuse the decoder for the next one
+    EXPECT_EQ(command_decoder::move, feed(decoder, frame, sizeof(frame)));
+    EXPECT_EQ(200, decoder.cmd.y);
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "plan_cache.h"
+#include "stitch_filter.h"
+#include "test_patterns.h"
+
+TEST(StitchFilterTests, shortStitchesAreMerged)
+{
+    // 20 stitches 1 apart, the middle 12 are not lock stitches
+    std::vector<stitch> section;
+    for (int i = 0; i < 20; i++)
+        section.push_back({i, 0, i == 0 ? jump_stitch : normal_stitch});
+    auto pattern = make_pes({{5, joined({section, run_at(500, 0, 2)})}});
+
+    EXPECT_EQ(8u, filter_stitches(pattern, 3));
+    auto &kept = pattern.blocks[0].stitches;
+    ASSERT_EQ(14u, kept.size());
+    const int xs[] = {0, 1, 2, 3, 6, 9, 12, 15, 16, 17, 18, 19, 500, 510};
+    for (std::size_t i = 0; i < kept.size(); i++)
+        EXPECT_EQ(xs[i], kept.x(i)) << "stitch " << i;
+    EXPECT_TRUE(kept.jump(12));
+}
+
+TEST(StitchFilterTests, nothingShorterKeepsEverything)
+{
+    auto pattern = make_pes({{5, joined({run_at(0, 0, 12), run_at(500, 0, 12)})}});
+    EXPECT_EQ(0u, filter_stitches(pattern, 5));
+    EXPECT_EQ(24u, pattern.blocks[0].stitches.size());
+}
+
+TEST(StitchFilterTests, duplicatesAloneAreDropped)
+{
+    // One section with the fifth point twice
+    auto duplicate = joined({run_at(0, 0, 5), {{40, 0}}, run_at(50, 0, 4)});
+    auto pattern = make_pes({{5, duplicate}});
+    pattern.blocks[0].stitches.set_jump(6, false);
+
+    EXPECT_EQ(1u, filter_stitches(pattern, 1));
+    auto &kept = pattern.blocks[0].stitches;
+    const int xs[] = {0, 10, 20, 30, 40, 50, 60, 70, 80};
+    ASSERT_EQ(9u, kept.size());
+    for (std::size_t i = 0; i < kept.size(); i++)
+        EXPECT_EQ(xs[i], kept.x(i)) << "stitch " << i;
+
+    pattern = make_pes({{5, duplicate}});
+    pattern.blocks[0].stitches.set_jump(6, false);
+    EXPECT_EQ(0u, filter_stitches(pattern, 0));
+}
+
+// The planner makes the last stitch a jump, filtered after it the
+// duplicate right before the tie-off would count as part of the tie-off.
+TEST(StitchFilterTests, planFiltersBeforeThePlanner)
+{
+    auto bytes = pes_bytes({{5, {{0, 0, jump_stitch}, {10, 0}, {20, 0}, {30, 0}, {40, 0}, {40, 0},
+                                 {50, 0}, {60, 0}, {70, 0}, {80, 0}}}});
+    plan_options options;
+    options.drop_duplicates = true;
+    plan_report report;
+    auto pattern = plan_cache::plan({{bytes}}, options, &report);
+
+    ASSERT_EQ(1u, pattern.blocks.size());
+    EXPECT_EQ(9u, pattern.blocks[0].stitches.size());
+    EXPECT_EQ(1u, report.dropped_stitches);
+    EXPECT_GT(report.seconds_saved, 0);
+
+    options.drop_duplicates = false;
+    pattern = plan_cache::plan({{bytes}}, options, &report);
+    EXPECT_EQ(10u, pattern.blocks[0].stitches.size());
+    EXPECT_EQ(0u, report.dropped_stitches);
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -0,0 +1,96 @@
+#ifndef TEST_PATTERNS_H
+#define TEST_PATTERNS_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "pes.h"
+
+// Small designs built in memory for the tests.
+
+struct test_block {
+    unsigned char color;
+    std::vector<stitch> stitches;
+};
+
+// A design with these blocks and the bounds of their stitches.
+inline pes make_pes(const std::vector<test_block> &blocks)
+{
+    pes pattern;
+    for (auto &b : blocks)
+    {
+        pattern.colors.push_back(pes_color(b.color));
+        pattern.blocks.push_back({pes_color(b.color), {}});
+        for (auto &s : b.stitches)
+        {
+            pattern.blocks.back().stitches.push_back(s);
+            pattern.min_x = std::min(pattern.min_x, s.x);
+            pattern.max_x = std::max(pattern.max_x, s.x);
+            pattern.min_y = std::min(pattern.min_y, s.y);
+            pattern.max_y = std::max(pattern.max_y, s.y);
+        }
+    }
+    return pattern;
+}
+
+// A short straight run of stitches 1 mm apart starting with a jump to x/y.
+inline std::vector<stitch> run_at(int x, int y, int count = 3)
+{
+    std::vector<stitch> stitches;
+    for (int i = 0; i < count; i++)
+        stitches.push_back({x + 10 * i, y, i == 0 ? jump_stitch : normal_stitch});
+    return stitches;
+}
+
+inline std::vector<stitch> joined(std::vector<std::vector<stitch>> runs)
+{
+    std::vector<stitch> all;
+    for (auto &r : runs)
+        all.insert(all.end(), r.begin(), r.end());
+    return all;
+}
+
+// The blocks as a PES file. Jump stitches and moves of more than 63 are
+// written as long form records, jumps with the jump flag.
+inline std::vector<unsigned char> pes_bytes(const std::vector<test_block> &blocks)
+{
+    const unsigned pec = 16;
+    std::vector<unsigned char> buf = {'#', 'P', 'E', 'S', '0', '0', '0', '1'};
+    for (int i = 0; i < 4; i++)
+        buf.push_back((pec >> (8 * i)) & 0xFF);
+    buf.resize(pec + 532);
+    buf[pec + 48] = blocks.size() - 1;
+    for (std::size_t i = 0; i < blocks.size(); i++)
+        buf[pec + 49 + i] = blocks[i].color;
+
+    int x = 0, y = 0;
+    for (std::size_t b = 0; b < blocks.size(); b++)
+    {
+        if (b > 0)
+            buf.insert(buf.end(), {0xFE, 0xB0, 0x00});
+        for (auto &s : blocks[b].stitches)
+        {
+            int dx = s.x - x, dy = s.y - y;
+            if (s.jumpstitch || std::abs(dx) > 63 || std::abs(dy) > 63)
+            {
+                for (int val : {dx, dy})
+                {
+                    buf.push_back(0x80 | (s.jumpstitch ? 0x10 : 0) | ((val >> 8) & 0x0F));
+                    buf.push_back(val & 0xFF);
+                }
+            }
+            else
+            {
+                buf.push_back(dx & 0x7F);
+                buf.push_back(dy & 0x7F);
+            }
+            x = s.x;
+            y = s.y;
+        }
+    }
+    buf.insert(buf.end(), {0xFF, 0x00});
+    return buf;
+}
+
+#endif /* TEST_PATTERNS_H */
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "test_patterns.h"
+#include "travel.h"
+
+namespace
+{
+
+std::vector<std::pair<int, int>> sorted_points(const stitch_list &stitches)
+{
+    std::vector<std::pair<int, int>> points;
+    for (auto s : stitches)
+        points.push_back({s.x, s.y});
+    std::sort(points.begin(), points.end());
+    return points;
+}
+
+} // namespace
+
+TEST(TravelTests, runsAreReorderedToShortenTravel)
+{
+    // Sewn as given the hoop goes back and forth across the hoop three times
+    auto pattern = make_pes({{5, joined({run_at(0, 0, 2), run_at(1000, 0, 2), run_at(30, 0, 2), run_at(1030, 0, 2)})}});
+    auto before_points = sorted_points(pattern.blocks[0].stitches);
+    auto before = measure_travel(pattern);
+    EXPECT_EQ(3u, before.jumps);
+    EXPECT_EQ(990 + 980 + 990, before.length);
+
+    optimize_travel(pattern);
+    auto after = measure_travel(pattern);
+    auto &stitches = pattern.blocks[0].stitches;
+    EXPECT_EQ(3u, after.jumps);
+    EXPECT_EQ(20 + 960 + 20, after.length);
+    EXPECT_EQ(before_points, sorted_points(stitches));
+    // The first run stays in front
+    EXPECT_EQ(0, stitches.x(0));
+    EXPECT_EQ(10, stitches.x(1));
+}
+
+TEST(TravelTests, shortestOrderIsKept)
+{
+    auto pattern = make_pes({{5, joined({run_at(0, 0, 2), run_at(30, 0, 2), run_at(1000, 0, 2)})}});
+    optimize_travel(pattern);
+    auto &stitches = pattern.blocks[0].stitches;
+    const int xs[] = {0, 10, 30, 40, 1000, 1010};
+    ASSERT_EQ(6u, stitches.size());
+    for (std::size_t i = 0; i < stitches.size(); i++)
+        EXPECT_EQ(xs[i], stitches.x(i)) << "stitch " << i;
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
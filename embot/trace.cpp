@@ -0,0 +1,123 @@
+#include "trace.h"
+
+#ifdef EMBOT_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+
+#include <fmt/format.h>
+
+namespace {
+
+constexpr std::size_t max_threads = 16;
+
+const char *phase_name(trace_phase phase)
+{
+    switch (phase)
+    {
+    case trace_phase::compile: return "compile";
+    case trace_phase::write: return "write";
+    case trace_phase::flush: return "flush";
+    case trace_phase::wait: return "wait";
+    case trace_phase::ack: return "ack";
+    }
+    return "?";
+}
+
+struct trace_buffer {
+    std::unique_ptr<trace_event[]> events;
+    std::size_t capacity{};
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> dropped{0};
+    trace_clock::time_point epoch;
+
+    std::atomic<std::uint16_t> threads{0};
+    const char *thread_names[max_threads]{};
+};
+
+trace_buffer buffer;
+
+std::uint16_t thread_index()
+{
+    thread_local std::uint16_t index = buffer.threads++;
+    return index;
+}
+
+std::int64_t since_epoch(trace_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - buffer.epoch).count();
+}
+
+}
+
+void trace_start(std::size_t capacity)
+{
+    buffer.events.reset(new trace_event[capacity]);
+    buffer.capacity = capacity;
+    buffer.next = 0;
+    buffer.dropped = 0;
+    buffer.epoch = trace_clock::now();
+}
+
+void trace_thread_name(const char *name)
+{
+    auto index = thread_index();
+    if (index < max_threads)
+        buffer.thread_names[index] = name;
+}
+
+void trace_record(trace_phase phase, trace_clock::time_point start, trace_clock::time_point end,
+                  std::size_t command, std::size_t count)
+{
+    auto slot = buffer.next.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= buffer.capacity)
+    {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer.events[slot] = {since_epoch(start), since_epoch(end), std::uint32_t(command), std::uint32_t(count),
+                           thread_index(), phase};
+}
+
+bool trace_dump(const std::string &prefix)
+{
+    auto count = std::min(buffer.next.load(), buffer.capacity);
+
+    std::ofstream json(prefix + ".json");
+    json << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":" << buffer.dropped << "},\"traceEvents\":[";
+    // The separator goes in front of every entry but the first, there may
+    // be thread names without events or neither.
+    const char *separator = "\n";
+    for (std::size_t t = 0; t < std::min<std::size_t>(buffer.threads, max_threads); t++)
+    {
+        if (!buffer.thread_names[t])
+            continue;
+        json << separator << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                                         t, buffer.thread_names[t]);
+        separator = ",\n";
+    }
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto &e = buffer.events[i];
+        json << separator << fmt::format("{{\"name\":\"{}\",\"cat\":\"embot\",\"ph\":\"X\",\"pid\":1,\"tid\":{},"
+                                         "\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"command\":{},\"count\":{}}}}}",
+                                         phase_name(e.phase), e.thread, e.start_ns / 1000.0, (e.end_ns - e.start_ns) / 1000.0,
+                                         e.command, e.count);
+        separator = ",\n";
+    }
+    json << "\n]}\n";
+
+    std::ofstream csv(prefix + ".csv");
+    csv << "phase,thread,command,count,start_ns,duration_ns\n";
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto &e = buffer.events[i];
+        csv << fmt::format("{},{},{},{},{},{}\n", phase_name(e.phase), e.thread, e.command, e.count,
+                           e.start_ns, e.end_ns - e.start_ns);
+    }
+    return bool(json) && bool(csv);
+}
+
+#endif
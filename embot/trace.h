@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Timing of every phase a command goes through on its way to the machine.
+//
+// Events are written into a buffer that is allocated once by `trace_start`,
+// recording one is a few stores and never allocates or locks. When the
+// buffer is full further events are dropped and counted. `trace_dump`
+// writes everything as Chrome trace JSON (load it in chrome://tracing or
+// ui.perfetto.dev) and as CSV.
+//
+// Tracing only exists in builds configured with -DEMBOT_TRACE=ON. Otherwise
+// all functions below are empty inlines and the macros expand to nothing.
+
+enum class trace_phase : std::uint8_t {
+    compile,   // encoding a color block, `command` is the block index and
+               // `count` the number of its stitches
+    write,     // handing commands to the port
+    flush,     // waiting for the output queue to drop to the watermark
+    wait,      // blocking until a reply is readable
+    ack,       // from writing a command until its final reply
+};
+
+// `command` is the index of the first command the event is about, `count`
+// the number of commands, both counted per sender since it was created.
+struct trace_event {
+    std::int64_t start_ns;
+    std::int64_t end_ns;
+    std::uint32_t command;
+    std::uint32_t count;
+    std::uint16_t thread;
+    trace_phase phase;
+};
+
+#ifdef EMBOT_TRACE
+
+using trace_clock = std::chrono::steady_clock;
+
+// Allocates room for `capacity` events and starts recording.
+void trace_start(std::size_t capacity);
+
+// Names the calling thread in the trace.
+void trace_thread_name(const char *name);
+
+void trace_record(trace_phase phase, trace_clock::time_point start, trace_clock::time_point end,
+                  std::size_t command, std::size_t count = 1);
+
+// Writes `prefix`.json and `prefix`.csv, false if that failed or tracing
+// is not compiled in.
+bool trace_dump(const std::string &prefix);
+
+// Records the time from its construction to the end of the enclosing scope.
+class trace_scope
+{
+public:
+    trace_scope(trace_phase phase, std::size_t command, std::size_t count = 1)
+        : phase_(phase), command_(command), count_(count), start_(trace_clock::now()) {}
+    ~trace_scope() { trace_record(phase_, start_, trace_clock::now(), command_, count_); }
+
+    trace_scope(const trace_scope &) = delete;
+    trace_scope &operator=(const trace_scope &) = delete;
+
+private:
+    trace_phase phase_;
+    std::size_t command_, count_;
+    trace_clock::time_point start_;
+};
+
+#define EMBOT_TRACE_CONCAT2(a, b) a##b
+#define EMBOT_TRACE_CONCAT(a, b) EMBOT_TRACE_CONCAT2(a, b)
+#define EMBOT_TRACE_SCOPE(...) trace_scope EMBOT_TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#define EMBOT_TRACE_RECORD(...) trace_record(__VA_ARGS__)
+
+#else
+
+inline void trace_start(std::size_t) {}
+inline void trace_thread_name(const char *) {}
+inline bool trace_dump(const std::string &) { return false; }
+
+#define EMBOT_TRACE_SCOPE(...)
+#define EMBOT_TRACE_RECORD(...)
+
+#endif
+
+#endif /* TRACE_H */
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "travel.h"
+
+namespace
+{
+
+struct point {
+    int x, y;
+};
+
+// Stitches first to last of a block, the first one is where the hoop
+// jumps to.
+struct run {
+    std::size_t first, last;
+    point begin, end;
+};
+
+// Runs in sewing order, `reversed` ones are sewn from their end.
+struct tour {
+    std::vector<std::size_t> order;
+    std::vector<char> reversed;
+
+    point begin(std::size_t pos, const std::vector<run> &runs) const
+    {
+        auto &r = runs[order[pos]];
+        return reversed[pos] ? r.end : r.begin;
+    }
+    point end(std::size_t pos, const std::vector<run> &runs) const
+    {
+        auto &r = runs[order[pos]];
+        return reversed[pos] ? r.begin : r.end;
+    }
+};
+
+} // namespace
+
+static long long distance(point a, point b)
+{
+    return std::max(std::abs(a.x - b.x), std::abs(a.y - b.y));
+}
+
+static point at(const stitch_list &stitches, std::size_t idx)
+{
+    return {stitches.x(idx), stitches.y(idx)};
+}
+
+// The jump stitches a chain really goes to, the others are passed over.
+static bool ends_chain(const stitch_list &stitches, std::size_t idx)
+{
+    return stitches.jump(idx) && (idx + 1 == stitches.size() || !stitches.jump(idx + 1));
+}
+
+static std::vector<run> split_runs(const stitch_list &stitches)
+{
+    std::vector<run> runs;
+    auto n = stitches.size();
+    for (std::size_t idx = 0; idx < n; idx++)
+    {
+        if (idx != 0 && !ends_chain(stitches, idx))
+            continue;
+        auto last = idx;
+        while (last + 1 < n && !stitches.jump(last + 1))
+            last++;
+        runs.push_back({idx, last, at(stitches, idx), at(stitches, last)});
+    }
+    return runs;
+}
+
+static long long tour_length(const tour &t, const std::vector<run> &runs)
+{
+    long long length = 0;
+    for (std::size_t pos = 1; pos < t.order.size(); pos++)
+        length += distance(t.end(pos - 1, runs), t.begin(pos, runs));
+    return length;
+}
+
+// From the end of the first run always on to the closest end of a run
+// not sewn yet.
+static tour nearest_neighbour(const std::vector<run> &runs)
+{
+    tour t{{0}, {0}};
+    std::vector<char> done(runs.size());
+    auto from = runs[0].end;
+    for (std::size_t step = 1; step < runs.size(); step++)
+    {
+        std::size_t best = 0;
+        bool best_reversed = false;
+        long long best_distance = -1;
+        for (std::size_t r = 1; r < runs.size(); r++)
+        {
+            if (done[r])
+                continue;
+            auto forward = distance(from, runs[r].begin), backward = distance(from, runs[r].end);
+            if (best_distance < 0 || std::min(forward, backward) < best_distance)
+            {
+                best = r;
+                best_reversed = backward < forward;
+                best_distance = std::min(forward, backward);
+            }
+        }
+        done[best] = 1;
+        t.order.push_back(best);
+        t.reversed.push_back(best_reversed);
+        from = best_reversed ? runs[best].begin : runs[best].end;
+    }
+    return t;
+}
+
+// Sews the runs at positions i to j in the opposite order and direction
+// whenever that makes the tour shorter, until nothing improves any more.
+static void two_opt(tour &t, const std::vector<run> &runs)
+{
+    constexpr int max_passes = 50;
+    auto m = t.order.size();
+    for (int pass = 0; pass < max_passes; pass++)
+    {
+        bool improved = false;
+        for (std::size_t i = 1; i < m; i++)
+        {
+            for (std::size_t j = i; j < m; j++)
+            {
+                auto before = t.end(i - 1, runs);
+                long long delta = distance(before, t.end(j, runs)) - distance(before, t.begin(i, runs));
+                if (j + 1 < m)
+                {
+                    auto after = t.begin(j + 1, runs);
+                    delta += distance(t.begin(i, runs), after) - distance(t.end(j, runs), after);
+                }
+                if (delta >= 0)
+                    continue;
+                std::reverse(t.order.begin() + i, t.order.begin() + j + 1);
+                std::reverse(t.reversed.begin() + i, t.reversed.begin() + j + 1);
+                for (auto k = i; k <= j; k++)
+                    t.reversed[k] = !t.reversed[k];
+                improved = true;
+            }
+        }
+        if (!improved)
+            break;
+    }
+}
+
+static void optimize_block(stitch_list &stitches)
+{
+    auto runs = split_runs(stitches);
+    if (runs.size() < 2)
+        return;
+
+    tour original;
+    for (std::size_t r = 0; r < runs.size(); r++)
+    {
+        original.order.push_back(r);
+        original.reversed.push_back(0);
+    }
+    auto t = nearest_neighbour(runs);
+    two_opt(t, runs);
+    if (tour_length(t, runs) >= tour_length(original, runs))
+        return;
+
+    // The passed over jump stitches of chains are left out, the hoop goes
+    // straight to the start of the next run anyway.
+    stitch_list sorted;
+    sorted.reserve(stitches.size());
+    for (std::size_t pos = 0; pos < t.order.size(); pos++)
+    {
+        auto &r = runs[t.order[pos]];
+        for (std::size_t k = 0; k <= r.last - r.first; k++)
+        {
+            auto s = stitches[t.reversed[pos] ? r.last - k : r.first + k];
+            if (pos != 0)
+                s.jumpstitch = k == 0 ? jump_stitch : normal_stitch;
+            s.speed = 0;
+            sorted.push_back(s);
+        }
+    }
+    stitches = std::move(sorted);
+}
+
+travel measure_travel(const pes &pattern)
+{
+    travel result;
+    for (auto &block : pattern.blocks)
+    {
+        auto &stitches = block.stitches;
+        // A chain at the start of a block comes from the block before
+        point from{};
+        bool have_from = false;
+        for (std::size_t idx = 1; idx < stitches.size(); idx++)
+        {
+            if (!stitches.jump(idx))
+                continue;
+            if (!stitches.jump(idx - 1))
+            {
+                from = at(stitches, idx - 1);
+                have_from = true;
+            }
+            if (have_from && ends_chain(stitches, idx))
+            {
+                result.jumps++;
+                result.length += distance(from, at(stitches, idx));
+            }
+        }
+    }
+    return result;
+}
+
+void optimize_travel(pes &pattern)
+{
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&] {
+        try
+        {
+            for (std::size_t b; (b = next++) < pattern.blocks.size();)
+                optimize_block(pattern.blocks[b].stitches);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            error = std::current_exception();
+        }
+    };
+
+    auto workers = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), pattern.blocks.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < workers; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+}
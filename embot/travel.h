@@ -0,0 +1,30 @@
+#ifndef TRAVEL_H
+#define TRAVEL_H
+
+#include <cstddef>
+
+#include "pes.h"
+
+// Where the hoop travels with the needle stopped. A chain of jump stitches
+// counts as one jump straight to its end, like cycle_builder sends it.
+// Lengths are in 1/10 mm on the axis that moves furthest, which is what
+// the time of a move depends on.
+struct travel {
+    std::size_t jumps{};
+    long long length{};
+};
+
+travel measure_travel(const pes &pattern);
+
+// Reorders the sections of every color block to shorten the travel between
+// them.
+//
+// A block is split into runs, each starting at a jump stitch (the end of
+// a chain of them) and holding the stitches up to the next one. The first
+// run stays in front, the others are put into nearest neighbour order and
+// improved with 2-opt, where any run may also be sewn backwards. Blocks
+// are optimized in parallel. A block is only changed if its travel gets
+// shorter. Call it before calc_speed, speeds are not kept.
+void optimize_travel(pes &pattern);
+
+#endif /* TRAVEL_H */
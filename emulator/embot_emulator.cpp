@@ -0,0 +1,77 @@
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iostream>
+#include <system_error>
+
+#include <cxxopts.hpp>
+#include <fmt/core.h>
+
+#include "emulator.h"
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("embot_emulator", "Emulates the embot firmware on a pseudo-terminal");
+    try
+    {
+        options.add_options()
+            ("l,link", "create a symlink to the pseudo-terminal at this path", cxxopts::value<std::string>())
+            ("b,buffer", "number of commands the firmware can buffer", cxxopts::value<int>()->default_value("16"))
+            ("rx-buffer", "bytes of received commands waiting for room in the buffer", cxxopts::value<int>()->default_value("256"))
+            ("r,rate", "needle motor ticks per second at speed 1, 0 executes instantly", cxxopts::value<double>()->default_value("128"))
+            ("a,ack-latency", "microseconds until a command is answered", cxxopts::value<int>()->default_value("0"))
+            ("busy-every", "answer every nth command with '!'", cxxopts::value<int>()->default_value("0"))
+            ("busy-time", "microseconds an injected busy state lasts", cxxopts::value<int>()->default_value("5000"))
+            ("ascii", "only support the ASCII protocol");
+
+        auto result = options.parse(argc, argv);
+
+        emulator_config config;
+        config.buffer_depth = result["buffer"].as<int>();
+        config.rx_buffer = result["rx-buffer"].as<int>();
+        config.ticks_per_second_per_speed = result["rate"].as<double>();
+        config.ack_latency = std::chrono::microseconds(result["ack-latency"].as<int>());
+        config.busy_every = result["busy-every"].as<int>();
+        config.busy_time = std::chrono::microseconds(result["busy-time"].as<int>());
+        config.binary_frames = config.stitch_frames = !result["ascii"].as<bool>();
+        if (config.buffer_depth < 1)
+            throw std::invalid_argument("buffer has to be at least 1");
+
+        int master, slave;
+        char name[100];
+        termios tio{};
+        cfmakeraw(&tio);
+        if (openpty(&master, &slave, name, &tio, nullptr) == -1)
+            throw std::system_error(errno, std::generic_category(), "openpty");
+
+        if (result.count("link"))
+        {
+            auto link = result["link"].as<std::string>();
+            ::unlink(link.c_str());
+            if (::symlink(name, link.c_str()) == -1)
+                throw std::system_error(errno, std::generic_category(), "symlink");
+        }
+        std::cout << "emulating embot on " << name << std::endl;
+
+        // The slave side stays open, so the pseudo-terminal survives senders
+        // which connect and disconnect.
+        firmware_emulator emulator(config);
+        while (emulator.run(master))
+        {
+            auto &stats = emulator.stats();
+            std::cout << fmt::format("job done: {} commands, {} moves, {} busy, {} bad frames, {} overruns, max {} queued",
+                                     stats.commands, stats.moves, stats.busy_replies, stats.bad_frames, stats.overruns, stats.max_queued)
+                      << std::endl;
+        }
+        ::close(slave);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << "\n"
+                  << options.help();
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * Emulation of the embot firmware.
+ *
+ * Commands are decoded with the reference decoder from protocol.h, buffered
+ * like the firmware does and "executed" in real time, so a sender sees the
+ * same replies, busy states and back pressure as with a real machine.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <system_error>
+
+#include "emulator.h"
+
+static const char reply_ok = 'k';
+
+static void write_all(int fd, const std::string &data)
+{
+    std::size_t written = 0;
+    while (written < data.size())
+    {
+        auto n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        written += n;
+    }
+}
+
+firmware_emulator::firmware_emulator(const emulator_config &config)
+    : config_(config)
+{
+}
+
+bool firmware_emulator::run(int fd)
+{
+    command_decoder decoder;
+    unsigned char buf[4096];
+
+    stats_ = {};
+    received_.clear();
+    received_bytes_ = 0;
+    queue_.clear();
+    replies_.clear();
+    owe_reply_ = disable_pending_ = disabled_ = false;
+    admitted_ = 0;
+    std::size_t command_size = 0;
+
+    while (true)
+    {
+        auto now = clock::now();
+        execute(now);
+
+        // Send all replies which are due in one go.
+        std::string out;
+        while (!replies_.empty() && replies_.front().first <= now)
+        {
+            out += replies_.front().second;
+            replies_.pop_front();
+        }
+        if (!out.empty())
+            write_all(fd, out);
+        if (disabled_ && replies_.empty())
+            return true;
+
+        // Sleep until there is input, a reply is due or a command is done.
+        auto next = clock::time_point::max();
+        if (!replies_.empty())
+            next = replies_.front().first;
+        if (!queue_.empty())
+            next = std::min(next, head_done_);
+        timespec timeout{}, *timeout_ptr = nullptr;
+        if (next != clock::time_point::max())
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::max(next - now, clock::duration::zero())).count();
+            timeout.tv_sec = ns / 1000000000;
+            timeout.tv_nsec = ns % 1000000000;
+            timeout_ptr = &timeout;
+        }
+
+        pollfd pfd{fd, POLLIN, 0};
+        int r = ppoll(&pfd, 1, timeout_ptr, nullptr);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "ppoll");
+        }
+        if (r == 0)
+            continue;
+        if (!(pfd.revents & POLLIN))
+            return false;
+
+        auto n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0)
+            return false;
+
+        now = clock::now();
+        for (int i = 0; i < n; i++)
+        {
+            auto res = decoder.push(buf[i]);
+            command_size++;
+            if (res != command_decoder::none)
+            {
+                handle(decoder, res, command_size, now);
+                command_size = 0;
+            }
+        }
+    }
+}
+
+void firmware_emulator::handle(const command_decoder &decoder, command_decoder::result r, std::size_t size, clock::time_point now)
+{
+    switch (r)
+    {
+    case command_decoder::enable:
+    {
+        std::string handshake(1, reply_ok);
+        if (config_.binary_frames)
+            handshake += binary_frames_tag;
+        if (config_.stitch_frames)
+            handshake += stitch_frames_tag;
+        for (auto c : handshake)
+            reply(c, now + config_.ack_latency);
+        break;
+    }
+    case command_decoder::disable:
+        disable_pending_ = true;
+        break;
+    case command_decoder::move:
+        stats_.moves++;
+        receive(exec_time(decoder.cmd.mot, decoder.cmd.speed), size, now);
+        break;
+    case command_decoder::stitches:
+    {
+        clock::duration total{};
+        for (std::size_t i = 0; i < decoder.stitch_count; i++)
+        {
+            auto &cmd = decoder.stitch_cmds[i];
+            total += exec_time(cmd.moving + cmd.stationary, cmd.speed);
+        }
+        stats_.moves += 2 * decoder.stitch_count;
+        receive(total, size, now);
+        break;
+    }
+    case command_decoder::bad_frame:
+        stats_.bad_frames++;
+        reply(reply_rejected, now + config_.ack_latency);
+        break;
+    case command_decoder::none:
+        break;
+    }
+}
+
+void firmware_emulator::receive(clock::duration exec_time, std::size_t size, clock::time_point now)
+{
+    if (received_bytes_ + size > std::size_t(config_.rx_buffer))
+    {
+        // The sender did not wait for the buffer, the command is lost.
+        stats_.overruns++;
+        reply(reply_rejected, now + config_.ack_latency);
+        return;
+    }
+    received_.emplace_back(exec_time, size);
+    received_bytes_ += size;
+    admit(now);
+}
+
+// Moves received commands into the buffer as long as there is room.
+void firmware_emulator::admit(clock::time_point now)
+{
+    while (!received_.empty() && int(queue_.size()) < config_.buffer_depth)
+    {
+        auto exec_time = received_.front().first;
+        received_bytes_ -= received_.front().second;
+        received_.pop_front();
+
+        if (queue_.empty())
+            head_done_ = now + exec_time;
+        queue_.push_back(exec_time);
+        stats_.max_queued = std::max(stats_.max_queued, int(queue_.size()));
+        stats_.commands++;
+        admitted_++;
+
+        auto when = now + config_.ack_latency;
+        if (int(queue_.size()) == config_.buffer_depth)
+        {
+            stats_.busy_replies++;
+            reply(reply_busy, when);
+            owe_reply_ = true;
+        }
+        else if (config_.busy_every > 0 && admitted_ % config_.busy_every == 0)
+        {
+            stats_.busy_replies++;
+            reply(reply_busy, when);
+            reply(reply_ok, when + config_.busy_time);
+        }
+        else
+        {
+            reply(reply_ok, when);
+        }
+    }
+}
+
+// Replies have to leave in the order of the commands.
+void firmware_emulator::reply(char c, clock::time_point when)
+{
+    when = std::max(when, last_reply_);
+    last_reply_ = when;
+    replies_.emplace_back(when, c);
+}
+
+void firmware_emulator::execute(clock::time_point now)
+{
+    while (!queue_.empty() && head_done_ <= now)
+    {
+        auto done = head_done_;
+        queue_.pop_front();
+        if (!queue_.empty())
+            head_done_ = done + queue_.front();
+        if (owe_reply_)
+        {
+            owe_reply_ = false;
+            reply(reply_ok, done + config_.ack_latency);
+        }
+        admit(done);
+    }
+    if (queue_.empty() && disable_pending_)
+    {
+        disable_pending_ = false;
+        disabled_ = true;
+        reply(reply_ok, now + config_.ack_latency);
+    }
+}
+
+firmware_emulator::clock::duration firmware_emulator::exec_time(int ticks, int speed) const
+{
+    if (config_.ticks_per_second_per_speed <= 0 || speed <= 0)
+        return {};
+    std::chrono::duration<double> seconds(ticks / (speed * config_.ticks_per_second_per_speed));
+    return std::chrono::duration_cast<clock::duration>(seconds);
+}
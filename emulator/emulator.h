@@ -0,0 +1,80 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <chrono>
+#include <deque>
+#include <string>
+
+#include "protocol.h"
+
+// Behavior of the emulated machine.
+struct emulator_config {
+    // Number of commands the firmware can buffer. The command which fills
+    // the buffer is answered with '!' and the real reply follows as soon as
+    // the oldest command has been executed.
+    int buffer_depth{16};
+    // Bytes of received commands which wait for room in the buffer. Commands
+    // beyond that are lost like on a serial receive buffer overrun.
+    int rx_buffer{256};
+    // Needle motor ticks per second at speed 1, the motor turns
+    // `speed * ticks_per_second_per_speed` ticks per second.
+    // 0 executes every command instantly.
+    double ticks_per_second_per_speed{128};
+    // Time between receiving a command and answering it.
+    std::chrono::microseconds ack_latency{0};
+    // Answer every nth command with '!' even if the buffer has room, 0 never.
+    int busy_every{0};
+    // How long such an injected busy state lasts.
+    std::chrono::microseconds busy_time{std::chrono::milliseconds(5)};
+    // Announce binary move frames and stitch frames in the reply to `>e`.
+    bool binary_frames{true};
+    bool stitch_frames{true};
+};
+
+struct emulator_stats {
+    long commands{};      // commands answered, a stitch frame counts once
+    long moves{};         // hoop moves, two per needle cycle
+    long bad_frames{};
+    long busy_replies{};
+    long overruns{};      // commands lost because the receive buffer was full
+    int max_queued{};
+};
+
+// Firmware side of the embot protocol on a file descriptor, usually the
+// master side of a pseudo-terminal.
+class firmware_emulator
+{
+public:
+    explicit firmware_emulator(const emulator_config &config);
+
+    // Serves commands on `fd` until `>d` has been answered.
+    // Returns false if the other side closed the connection before.
+    bool run(int fd);
+
+    const emulator_stats &stats() const { return stats_; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    void handle(const command_decoder &decoder, command_decoder::result r, std::size_t size, clock::time_point now);
+    void receive(clock::duration exec_time, std::size_t size, clock::time_point now);
+    void admit(clock::time_point now);
+    void reply(char c, clock::time_point when);
+    void execute(clock::time_point now);
+    clock::duration exec_time(int ticks, int speed) const;
+
+    emulator_config config_;
+    emulator_stats stats_;
+    std::deque<std::pair<clock::duration, std::size_t>> received_;  // waiting for room, with size
+    std::size_t received_bytes_{};
+    std::deque<clock::duration> queue_;      // execution time of the buffered commands
+    clock::time_point head_done_;            // when the first buffered command is done
+    std::deque<std::pair<clock::time_point, char>> replies_;
+    clock::time_point last_reply_;
+    bool owe_reply_{};                       // '!' sent because the buffer is full
+    bool disable_pending_{};
+    bool disabled_{};
+    long admitted_{};
+};
+
+#endif /* EMULATOR_H */
@@ -1,210 +1,198 @@
 #include <iostream>
 #include "serial/serial.h"
 #include "pes.h"
+#include "sender.h"
+#include "duplex_sender.h"
+#include "job.h"
+#include "plan_cache.h"
+#include "trace.h"
+#include "travel.h"
 #include <fmt/core.h>
 #include <unistd.h>
 #include <fstream>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <vector>
 
 #include <cxxopts.hpp>
 
-float x_offset = 0.0;
-float y_offset = 0.0;
-
-// Calculate ticks per rotation (one stitch)
-// facts (for my setup):
-// 200 steps per one motor rotation
-// microstepping: 16 ticks per step
-// 16 teeth pulley on the motor
-// 58 teeth pulley on the sewing machine
-// -> 200*16*(58/16) = 11600
-const int ticks_per_stitch = 11600;
-
-// Calculate the part of the stitch, when the hoop is able to move.
-// Only a quater of one stitch rotation can be used to move the hoop.
-// The beginning of this Part is, when the needle is on it's highes position.
-// This is the point when the sewing thread is free in will not break.
-const int ticks_hoop_moving = (ticks_per_stitch / 4);
-
-// ... the spare ticks belong to the part, when the hoop is not moving.
-// If there is a remainder of the division, add it to this part.
-// ticks_hoop_moving + ticks_hoop_not_moving has to be exactly ticks_per_stitch,
-// otherwise the stitches drift away and it's possible that the needle is in the Fabric,
-// when the hoop moves.
-const int ticks_hoop_not_moving = (ticks_per_stitch / 4) * 3 + ticks_per_stitch % 4;
-
-// This is the max speed value on which the stepper motor of the sewing machine
-// will properly work.
-// You have to try it out.
-// This value works on my setup.
-const int max_speed = 900;
-
-void send_one(serial::Serial &ser, const stitch &s, int mot)
-{
-    auto cmmd = fmt::format(">m{};{};{};{};", (x_offset + s.x) / 10, (y_offset + s.y) / 10, int(mot), s.speed);
-    std::cout << (cmmd) << "\n";
-    ser.write(cmmd);
-    ser.flush();
-    while (ser.available() < 1)
-    {
-    }
-    auto x = ser.read();
-    std::cout << (x) << "\n";
-    if (x[0] == '!')
-    {
-        while (ser.available() < 1)
-        {
-        }
-        x = ser.read();
-        std::cout << (x) << "\n";
-    }
-}
-
-// Precalculate speed for each stitch
-// Ramp up speed after- and down before jump stitches
-void calc_speed(pes &pattern)
-{
-
-    for (auto &block : pattern.blocks)
-    {
-        for (auto &stitch : block.stitches)
-        {
-            stitch.speed = max_speed;
-        }
-    }
-    for (auto &block : pattern.blocks)
-    {
-        for (int idx = 0; idx < block.stitches.size(); ++idx)
-        {
-            auto &current = block.stitches[idx];
-
-            // We treat the first and stitch as if it were a jump stitch.
-            // In this cases we need low speed.
-            if (idx == 0 || idx == (block.stitches.size()-1))
-                current.jumpstitch = 1;
-
-            if (current.jumpstitch)
-            {
-                // This is how it should look after this block has been run through
-                //
-                // ____       ____  max speed
-                //     \     /
-                //      \   /
-                //       \-/        min speed for jump stitch
-                //
-                //        ^
-                //        |
-                //     current
-                //     position
-
-                current.speed = 100;
-
-                // go backwards from current position -> ramp down
-                stitch previous = current;
-                for (int idx_reverse = idx - 1;; --idx_reverse)
-                {
-                    if (idx_reverse < 0)
-                        break;
-
-                    auto &curent_stitch = block.stitches[idx_reverse];
-
-                    int val = previous.speed + 100;
-
-                    if (val > max_speed)
-                        val = max_speed;
-
-                    if (curent_stitch.speed > val)
-                        curent_stitch.speed = val;
-                    else
-                        break;
-
-                    if (val == max_speed)
-                        break;
-
-                    previous = curent_stitch;
-                }
-
-                // go forward from current position -> ramp up
-                previous = current;
-                for (int idx_forward = idx + 1;; idx_forward++)
-                {
-                    if (idx_forward >= block.stitches.size())
-                        break;
-                    
-                    auto &current_stitch = block.stitches[idx_forward];
-                    
-                    int val = previous.speed + 100;
-                    
-                    if (val > max_speed)
-                        val = max_speed;
-                    
-                    current_stitch.speed = val;
-
-                    if (val == max_speed)
-                        break;
-                    previous = current_stitch;
-                }
-            }
-        }
-    }
-}
-
 int main(int argc, char **argv)
 {
     cxxopts::Options options("stitcher", "Sends data from a pes file to the embroidery machine");
     try
     {
-        options.add_options()("f,file", "path to the pes file", cxxopts::value<std::string>())("s,serial", "serial port", cxxopts::value<std::string>());
+        options.add_options()
+            ("f,file", "path to the pes file, repeat it to sew several designs in one hoop", cxxopts::value<std::vector<std::string>>())
+            ("offset", "x:y in mm where the origin of the design goes, once for every file", cxxopts::value<std::vector<std::string>>())
+            ("s,serial", "serial port", cxxopts::value<std::string>())
+            ("w,window", "number of commands in flight, 1 means stop-and-wait", cxxopts::value<int>()->default_value("1"))
+            ("t,timeout", "milliseconds to wait for a reply of the machine", cxxopts::value<int>()->default_value("30000"))
+            ("a,ascii", "always use the ASCII protocol, even if the machine supports binary frames")
+            ("d,duplex", "drive the port from separate writer and reader threads")
+            ("k,batch", "stitches per stitch frame, if the machine supports them", cxxopts::value<int>()->default_value("8"))
+            ("watermark", "bytes that may wait in the output queue of the port", cxxopts::value<int>()->default_value(std::to_string(default_output_watermark)))
+            ("no-cache", "decode and plan the design while sending it instead of using the cache of planned designs")
+            ("cache-dir", "where planned designs are cached", cxxopts::value<std::string>()->default_value(plan_cache::default_dir().string()))
+            ("cache-size", "MB the cached designs may take, the ones used longest ago go first", cxxopts::value<int>()->default_value(std::to_string(plan_cache::default_max_bytes >> 20)))
+            ("optimize-travel", "reorder the sections of every color to shorten the jumps between them")
+            ("hoop-model", "limit the speed of long stitches by the hoop model in machine.h, its constants are uncalibrated placeholders")
+            ("min-stitch", "drop stitches shorter than this many mm (0.3 is a good start), 0 keeps all", cxxopts::value<double>()->default_value("0"))
+            ("drop-duplicates", "drop stitches on the same point as the one before, also without min-stitch")
+            ("trace", "write the timing of every command to <prefix>.json and <prefix>.csv, needs a build with EMBOT_TRACE", cxxopts::value<std::string>());
 
         auto result = options.parse(argc, argv);
 
-        auto ser = serial::Serial(result["serial"].as<std::string>());
-
-        auto buffer = read_file(result["file"].as<std::string>());
-        pes pattern = parse_pes(buffer);
-        buffer = {};
+        auto stitches_per_frame = result["batch"].as<int>();
+        if (stitches_per_frame < 1 || stitches_per_frame > int(max_stitches_per_frame))
+            throw std::invalid_argument(fmt::format("batch has to be between 1 and {}", max_stitches_per_frame));
+
+        auto watermark = result["watermark"].as<int>();
+        if (watermark < 0 || watermark > int(max_output_watermark))
+            throw std::invalid_argument(fmt::format("watermark has to be between 0 and {}", max_output_watermark));
+
+        auto paths = result["file"].as<std::vector<std::string>>();
+        auto offsets = result.count("offset") ? result["offset"].as<std::vector<std::string>>() : std::vector<std::string>();
+        if (offsets.size() > paths.size())
+            throw std::invalid_argument("more offsets than files");
+        plan_options plan;
+        plan.optimize_travel = result["optimize-travel"].as<bool>();
+        plan.hoop_model = result["hoop-model"].as<bool>();
+        plan.min_stitch = int(std::lround(result["min-stitch"].as<double>() * 10));
+        plan.drop_duplicates = result["drop-duplicates"].as<bool>();
+        auto filtering = plan.min_stitch > 0 || plan.drop_duplicates;
+        if (result["no-cache"].as<bool>() && (plan.optimize_travel || paths.size() > 1 || !offsets.empty() || filtering))
+            throw std::invalid_argument("optimize-travel, min-stitch, drop-duplicates, offset and several files need the whole design and can't be used with no-cache");
+
+        auto cache_size = result["cache-size"].as<int>();
+        if (cache_size < 0)
+            throw std::invalid_argument("cache-size can't be negative");
 
-        calc_speed(pattern);
+        auto ser = serial::Serial(result["serial"].as<std::string>());
+        command_sender sender(ser, result["window"].as<int>(), result["timeout"].as<int>(), &std::cout);
+
+        // Without a cached plan the stitches are decoded and planned while
+        // they are sent, only the bounds are needed up front.
+        auto use_cache = !result["no-cache"].as<bool>();
+        auto streamable = paths.size() == 1 && offsets.empty() && !plan.optimize_travel && !filtering;
+        std::vector<std::unique_ptr<mapped_file>> files;
+        std::vector<design_file> designs;
+        for (std::size_t i = 0; i < paths.size(); i++)
+        {
+            files.push_back(std::make_unique<mapped_file>(paths[i]));
+            designs.push_back({*files.back()});
+            if (i < offsets.size())
+            {
+                auto colon = offsets[i].find(':');
+                if (colon == std::string::npos)
+                    throw std::invalid_argument("offset has to be x:y");
+                designs.back().x = int(std::lround(std::stod(offsets[i].substr(0, colon)) * 10));
+                designs.back().y = int(std::lround(std::stod(offsets[i].substr(colon + 1)) * 10));
+            }
+        }
+        // A streamed design is decoded while the job runs, which takes long.
+        // A file truncated in the meantime would raise SIGBUS on the next
+        // read of the mapping, so the stitches are decoded from a copy.
+        std::vector<unsigned char> streamed_bytes;
+        if (streamable)
+        {
+            auto bytes = designs.front().bytes;
+            streamed_bytes.assign(bytes.data, bytes.data + bytes.size);
+            designs.front().bytes = streamed_bytes;
+            files.clear();
+        }
+        auto source = designs.front().bytes;
+        plan_cache cache(result["cache-dir"].as<std::string>(), std::uintmax_t(cache_size) << 20);
+        std::optional<pes> planned;
+        plan_report report;
+        std::future<void> cache_writer;
+        if (use_cache && streamable)
+        {
+            // On a miss the design is streamed like with no-cache, so the
+            // first stitch goes out as early, and the entry for the next run
+            // is planned and written next to it.
+            auto key = plan_cache::key(designs, plan);
+            planned = cache.load(key);
+            if (!planned)
+                cache_writer = std::async(std::launch::async, [&cache, &designs, plan, key] {
+                    cache.store(key, plan_cache::plan(designs, plan));
+                });
+        }
+        else if (use_cache)
+            planned = cache.load_or_plan(designs, plan, &report);
+        auto streaming = !planned;
+        std::size_t stitches = 0;
+        pes pattern = streaming ? parse_pes_header(source, &stitches) : std::move(*planned);
+        for (auto &block : pattern.blocks)
+            stitches += block.stitches.size();
+        auto blocks = streaming ? pattern.colors.size() : pattern.blocks.size();
+        if (filtering)
+            std::cout << fmt::format("dropped {} stitches, about {:.1f} s less\n", report.dropped_stitches, report.seconds_saved);
+        if (plan.optimize_travel)
+        {
+            auto moves = measure_travel(pattern);
+            std::cout << fmt::format("{} jumps, {:.1f} mm of travel\n", moves.jumps, moves.length / 10.0);
+        }
 
         ser.write(">e");
         sleep(1);
-        while (ser.available() < 1)
+        auto handshake = sender.read_reply();
+        std::cout << (handshake) << "\n";
+        auto format = negotiate_format(handshake, result["ascii"].as<bool>(), stitches_per_frame);
+        if (format.stitch_frames)
+            std::cout << "using stitch frames\n";
+        else if (format.binary_frames)
+            std::cout << "using binary move frames\n";
+
+        if (result.count("trace"))
         {
+            // At most four events per command and one per block for compiling
+            // it. A stitch takes two move commands or a part of a stitch
+            // frame, the room left over takes the moves of long jumps.
+            auto commands = format.stitch_frames ? stitches / format.stitches_per_frame + blocks : 2 * stitches;
+            trace_start(4 * commands + blocks + 1024);
+            trace_thread_name("main");
         }
-        std::cout << (ser.read()) << "\n";
 
-        if (pattern.min_x < 0)
-            x_offset = -pattern.min_x;
-        if (pattern.min_y < 0)
-            y_offset = -pattern.min_y;
+        std::unique_ptr<duplex_sender> duplex;
+        if (result["duplex"].as<bool>())
+            duplex = std::make_unique<duplex_sender>(ser, result["window"].as<int>(), result["timeout"].as<int>(), &std::cout);
+        command_link &link = duplex ? static_cast<command_link &>(*duplex) : sender;
+        link.set_output_watermark(watermark);
 
-        for (auto it_blocks = pattern.blocks.begin(); it_blocks != pattern.blocks.end(); ++it_blocks)
-        {
-            auto ansiEscapedColor = fmt::format("\x1B[48;2;{};{};{}m   \033[0m\n", (*it_blocks).block_color.r, (*it_blocks).block_color.g, (*it_blocks).block_color.b);
+        auto wait_for_color = [](const color &block_color) {
+            auto ansiEscapedColor = fmt::format("\x1B[48;2;{};{};{}m   \033[0m\n", block_color.r, block_color.g, block_color.b);
             std::cout << "\nNext color: " << ansiEscapedColor << "hit return when ready\n";
             while (std::cin.get() != '\n')
             {
             };
-
-            for (auto it_stitches = (*it_blocks).stitches.begin(); it_stitches != (*it_blocks).stitches.end(); ++it_stitches)
+        };
+        if (!streaming)
+        {
+            job_sender job(link, format, pattern, &std::cout, plan.hoop_model);
+            for (std::size_t idx = 0; idx < pattern.blocks.size(); idx++)
             {
-                if ((*it_stitches).jumpstitch == 0)
-                {
-                    send_one(ser, (*it_stitches), ticks_hoop_moving);
-                    send_one(ser, (*it_stitches), ticks_hoop_not_moving);
-                }
-                else
-                {
-                    send_one(ser, (*it_stitches), 0);
-                    send_one(ser, (*it_stitches), ticks_per_stitch);
-                }
+                wait_for_color(pattern.blocks[idx].block_color);
+                job.send_block(idx);
             }
         }
-        ser.write(">d");
-        while (ser.available() < 1)
+        else
         {
+            job_streamer job(link, format, pattern, pec_stitches(source), &std::cout, plan.hoop_model);
+            for (auto it_colors = pattern.colors.begin(); job.next_block(); ++it_colors)
+            {
+                wait_for_color(*it_colors);
+                job.send_block();
+            }
         }
-        std::cout << ser.read() << "\n";
+        duplex.reset();
+        ser.write(">d");
+        ser.flush();
+        std::cout << sender.read_reply() << "\n";
         std::cout.flush();
+
+        if (result.count("trace") && !trace_dump(result["trace"].as<std::string>()))
+            std::cout << "could not write the trace, was term_control built with EMBOT_TRACE?\n";
     }
     catch (const std::exception &e)
     {
@@ -212,5 +200,10 @@ int main(int argc, char **argv)
                   << options.help();
         return -1;
     }
+    catch (const char *e)
+    {
+        std::cout << e << "\n";
+        return -1;
+    }
     return 0;
 }
@@ -10,9 +10,20 @@
  * it into C. And I turned some parts into C++.
  */
 #include <string.h>
+#include <algorithm>
 
+#ifdef _WIN32
 #include <fstream>
-#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "pes.h"
 
@@ -84,23 +95,112 @@ static color color_def[256] = {
     {"Color64", 255, 200, 200},
 };
 
-std::vector<unsigned char> read_file(const std::filesystem::path& path)
+#ifdef _WIN32
+
+mapped_file::mapped_file(const std::filesystem::path& path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+        throw "Could not open file";
+    contents_.resize(std::filesystem::file_size(path));
+    input.read(reinterpret_cast<char *>(contents_.data()), contents_.size());
+    data_ = contents_.data();
+    size_ = contents_.size();
+}
+
+mapped_file::~mapped_file()
+{
+}
+
+#else
+
+mapped_file::mapped_file(const std::filesystem::path& path)
 {
-    std::ifstream input( path, std::ios::binary );
-    auto buff = std::vector<unsigned char>(std::istreambuf_iterator<char>(input), {});
-    for(int i = 0; i<8;i++)
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw "Could not open file";
+    struct stat st;
+    if (fstat(fd, &st) == -1)
     {
-        buff.push_back(0);
+        close(fd);
+        throw "Could not open file";
     }
-    return buff;
+    size_ = st.st_size;
+    /* An empty file can not be mapped, it stays an empty span */
+    if (size_ > 0)
+    {
+        void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            throw "Could not map file";
+        }
+        madvise(map, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const unsigned char *>(map);
+    }
+    /* The mapping stays valid without the descriptor */
+    close(fd);
 }
 
+mapped_file::~mapped_file()
+{
+    if (data_)
+        munmap(const_cast<unsigned char *>(data_), size_);
+}
+
+#endif
+
 #define get_u8(buf, offset) (*(unsigned char *)((offset) + (const char *)(buf)))
 #define get_le32(buf, offset) (*(unsigned int *)((offset) + (const char *)(buf)))
 
-static std::vector<std::reference_wrapper<color>> parse_pes_colors(const std::vector<unsigned char> fileBuffer, unsigned int pec)
+void stitch_list::reserve(std::size_t n)
+{
+    x_.reserve(n);
+    y_.reserve(n);
+    jumps_.reserve((n + 63) / 64);
+    speed_.reserve(n);
+}
+
+void stitch_list::push_back(const stitch &s)
+{
+    if (s.x < std::numeric_limits<std::int16_t>::min() || s.x > std::numeric_limits<std::int16_t>::max() ||
+        s.y < std::numeric_limits<std::int16_t>::min() || s.y > std::numeric_limits<std::int16_t>::max())
+        throw "Design too large";
+    if (size() % 64 == 0)
+        jumps_.push_back(0);
+    x_.push_back(std::int16_t(s.x));
+    y_.push_back(std::int16_t(s.y));
+    speed_.push_back(std::uint16_t(s.speed));
+    set_jump(size() - 1, s.jumpstitch);
+}
+
+void stitch_list::append(const stitch *s, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+        push_back(s[i]);
+}
+
+void stitch_list::assign(const std::int16_t *x, const std::int16_t *y, const std::uint64_t *jumps, const std::uint16_t *speed, std::size_t n)
+{
+    x_.assign(x, x + n);
+    y_.assign(y, y + n);
+    jumps_.assign(jumps, jumps + (n + 63) / 64);
+    speed_.assign(speed, speed + n);
+}
+
+color& pes_color(unsigned char index)
+{
+    return color_def[index];
+}
+
+unsigned char pes_color_index(const color& c)
+{
+    return &c - color_def;
+}
+
+static std::vector<std::reference_wrapper<color>> parse_pes_colors(byte_span fileBuffer, unsigned int pec)
 {
-    const void *buf = fileBuffer.data();
+    const void *buf = fileBuffer.data;
     int nr_colors = get_u8(buf, pec + 48) + 1;
     int i;
     std::vector<std::reference_wrapper<color>> colors;
@@ -111,45 +211,59 @@ static std::vector<std::reference_wrapper<color>> parse_pes_colors(const std::ve
     return colors;
 }
 
-static int parse_pes_stitches(const std::vector<unsigned char>& fileBuffer, unsigned int pec, pes& pes)
+static void update_bounds(pes& pes, const stitch& s)
 {
-    int oldx, oldy;
-    const unsigned char *buf = fileBuffer.data(), *p, *end;
-
-    p = buf + pec + 532;
-    end = buf + fileBuffer.size()-8;
-
-    oldx = oldy = 0;
-
-    int color_idx{0};
+    if (s.x < pes.min_x)
+        pes.min_x = s.x;
+    if (s.x > pes.max_x)
+        pes.max_x = s.x;
+    if (s.y < pes.min_y)
+        pes.min_y = s.y;
+    if (s.y > pes.max_y)
+        pes.max_y = s.y;
+}
 
-    pes.blocks.push_back({pes.colors[color_idx++]});
+/* Type flags in the first byte of a long form coordinate. Long form
+ * coordinates without them are ordinary long stitches. */
+static int long_form_type(int byte)
+{
+    if (byte & 0x20)
+        return trim_stitch;
+    if (byte & 0x10)
+        return jump_stitch;
+    return normal_stitch;
+}
 
-    while (p < end)
+pec_decoder::result pec_decoder::next(stitch &s)
+{
+    while (end_ - p >= 2)
     {
-        int val1 = p[0], val2 = p[1], jumpstitch = 0;
+        int val1 = p[0], val2 = p[1], jumpstitch = normal_stitch;
         p += 2;
         if (val1 == 255 && !val2)
-            return 0;
+        {
+            p = end_;
+            return end;
+        }
         if (val1 == 254 && val2 == 176)
         {
-            if (pes.blocks.back().stitches.size())
-            {
-                pes.blocks.push_back({pes.colors[color_idx++]});
-            }
+            if (p == end_)
+                break;
             p++; /* Skip byte */
-            continue;
+            return color_change;
         }
 
         /* High bit set means 12-bit offset, otherwise 7-bit signed delta */
         if (val1 & 0x80)
         {
+            jumpstitch = long_form_type(val1);
             val1 = ((val1 & 15) << 8) + val2;
             /* Signed 12-bit arithmetic */
             if (val1 & 2048)
                 val1 -= 4096;
+            if (p == end_)
+                break;
             val2 = *p++;
-            jumpstitch = 1;
         }
         else
         {
@@ -159,11 +273,13 @@ static int parse_pes_stitches(const std::vector<unsigned char>& fileBuffer, unsi
 
         if (val2 & 0x80)
         {
+            if (p == end_)
+                break;
+            jumpstitch = std::max(jumpstitch, long_form_type(val2));
             val2 = ((val2 & 15) << 8) + *p++;
             /* Signed 12-bit arithmetic */
             if (val2 & 2048)
                 val2 -= 4096;
-            jumpstitch = 1;
         }
         else
         {
@@ -177,37 +293,222 @@ static int parse_pes_stitches(const std::vector<unsigned char>& fileBuffer, unsi
         oldx = val1;
         oldy = val2;
 
-        if (val1 < pes.min_x)
-            pes.min_x = val1;
-        if (val1 > pes.max_x)
-            pes.max_x = val1;
-        if (val2 < pes.min_y)
-            pes.min_y = val2;
-        if (val2 > pes.max_y)
-            pes.max_y = val2;
+        s = {val1, val2, jumpstitch};
+        return stitch_record;
+    }
+    return end;
+}
+
+#ifdef __SSE2__
+
+static_assert(sizeof(stitch) == 4 * sizeof(int), "stitches are stored as four 32-bit lanes");
+
+/* Lane wise minimum and maximum of signed 32-bit values, SSE2 only has
+ * them for 16-bit values */
+static inline __m128i min_epi32(__m128i a, __m128i b)
+{
+    __m128i lt = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+}
+
+static inline __m128i max_epi32(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+/* Turns two x/y deltas into absolute positions: adds the first pair to
+ * the second and `base`, the previous position, to both */
+static inline __m128i prefix_sum_pairs(__m128i deltas, __m128i base)
+{
+    return _mm_add_epi32(_mm_add_epi32(deltas, _mm_slli_si128(deltas, 8)), base);
+}
 
-        pes.blocks.back().stitches.push_back({val1,val2,jumpstitch});
+/* Stores the two positions of `pos` as stitches with all flags cleared */
+static inline void store_pairs(stitch *out, __m128i pos)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi64(pos, _mm_setzero_si128()));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 1), _mm_unpackhi_epi64(pos, _mm_setzero_si128()));
+}
+
+#endif
+
+/* Decodes runs of short records, eight at a time */
+std::size_t pec_decoder::next_short_stitches(stitch *out, std::size_t max, pes &bounds)
+{
+    std::size_t n = 0;
+
+#ifdef __SSE2__
+    /* Lanes are x, y, x, y */
+    __m128i pos = _mm_set_epi32(oldy, oldx, oldy, oldx);
+    __m128i lo = _mm_set_epi32(bounds.min_y, bounds.min_x, bounds.min_y, bounds.min_x);
+    __m128i hi = _mm_set_epi32(bounds.max_y, bounds.max_x, bounds.max_y, bounds.max_x);
+    const __m128i sign = _mm_set1_epi8(64);
+
+    /* 16 bytes without any high bit set are 8 short records, every
+     * special or long record starts with a byte that has it set */
+    while (max - n >= 8 && end_ - p >= 16)
+    {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        if (_mm_movemask_epi8(raw))
+            break;
+
+        /* Sign extend the 7-bit deltas to 8, 16 and finally 32 bits */
+        __m128i d8 = _mm_sub_epi8(_mm_xor_si128(raw, sign), sign);
+        __m128i d16_lo = _mm_srai_epi16(_mm_unpacklo_epi8(d8, d8), 8);
+        __m128i d16_hi = _mm_srai_epi16(_mm_unpackhi_epi8(d8, d8), 8);
+        __m128i d32[4] = {
+            _mm_srai_epi32(_mm_unpacklo_epi16(d16_lo, d16_lo), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(d16_lo, d16_lo), 16),
+            _mm_srai_epi32(_mm_unpacklo_epi16(d16_hi, d16_hi), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(d16_hi, d16_hi), 16),
+        };
+        for (int i = 0; i < 4; i++)
+        {
+            __m128i abs = prefix_sum_pairs(d32[i], pos);
+            pos = _mm_shuffle_epi32(abs, _MM_SHUFFLE(3, 2, 3, 2));
+            lo = min_epi32(lo, abs);
+            hi = max_epi32(hi, abs);
+            store_pairs(out + n + 2 * i, abs);
+        }
+        n += 8;
+        p += 16;
     }
-    return 0;
+
+    oldx = _mm_cvtsi128_si32(pos);
+    oldy = _mm_cvtsi128_si32(_mm_shuffle_epi32(pos, _MM_SHUFFLE(1, 1, 1, 1)));
+    lo = min_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    hi = max_epi32(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    bounds.min_x = _mm_cvtsi128_si32(lo);
+    bounds.min_y = _mm_cvtsi128_si32(_mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 1, 1, 1)));
+    bounds.max_x = _mm_cvtsi128_si32(hi);
+    bounds.max_y = _mm_cvtsi128_si32(_mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 1, 1, 1)));
+#endif
+
+    return n;
 }
 
-pes parse_pes(const std::vector<unsigned char>& pesBin)
+std::size_t pec_decoder::next_stitches(stitch *out, std::size_t max, pes &bounds)
 {
-    const void *buf = pesBin.data();
-    const unsigned int size = pesBin.size();
-    unsigned int pec{};
+    std::size_t n = 0;
+    while (n < max)
+    {
+        n += next_short_stitches(out + n, max - n, bounds);
 
-    pes thePes{};
+        /* Records up to and including the one that stopped the fast path */
+        while (n < max && end_ - p >= 2)
+        {
+            if ((p[0] == 255 && !p[1]) || (p[0] == 254 && p[1] == 176))
+                return n;
+            bool short_record = !((p[0] | p[1]) & 0x80);
+            stitch s;
+            if (next(s) != stitch_record)
+                return n;
+            update_bounds(bounds, s);
+            out[n++] = s;
+            if (!short_record)
+                break;
+        }
+        if (end_ - p < 2)
+            break;
+    }
+    return n;
+}
+
+static pec_decoder pec_stitches(byte_span fileBuffer, unsigned int pec)
+{
+    const unsigned char *buf = fileBuffer.data;
+    return {buf + pec + 532, buf + fileBuffer.size};
+}
+
+static int parse_pes_stitches(byte_span fileBuffer, unsigned int pec, pes& pes)
+{
+    auto decoder = pec_stitches(fileBuffer, pec);
+    int color_idx{0};
+    stitch s, run[256];
+
+    pes.blocks.push_back({pes.colors[color_idx++]});
+
+    while (true)
+    {
+        auto n = decoder.next_stitches(run, 256, pes);
+        if (n > 0)
+        {
+            pes.blocks.back().stitches.append(run, n);
+            continue;
+        }
+
+        auto r = decoder.next(s);
+        if (r == pec_decoder::end)
+            return 0;
+        if (r == pec_decoder::color_change)
+        {
+            if (pes.blocks.back().stitches.size())
+            {
+                pes.blocks.push_back({pes.colors[color_idx++]});
+            }
+            continue;
+        }
+        update_bounds(pes, s);
+        pes.blocks.back().stitches.push_back(s);
+    }
+}
+
+static unsigned int pec_offset(byte_span pesBin)
+{
+    const void *buf = pesBin.data;
+    const std::size_t size = pesBin.size;
+    unsigned int pec{};
 
     if (size < 48)
         throw "File to small";
     if (memcmp(buf, "#PES", 4))
         throw "Not a pes file";
     pec = get_le32(buf, 8);
-    if (pec + 532 >= size)
+    if (std::size_t(pec) + 532 >= size)
         throw "File to small";
+    return pec;
+}
+
+pes parse_pes(byte_span pesBin)
+{
+    auto pec = pec_offset(pesBin);
+
+    pes thePes{};
     thePes.colors = parse_pes_colors(pesBin, pec);
     parse_pes_stitches(pesBin, pec, thePes);
     return thePes;
 }
 
+pes parse_pes_header(byte_span pesBin, std::size_t *stitch_count)
+{
+    auto pec = pec_offset(pesBin);
+
+    pes thePes{};
+    thePes.colors = parse_pes_colors(pesBin, pec);
+
+    auto decoder = pec_stitches(pesBin, pec);
+    pec_decoder::result r;
+    stitch s, run[256];
+    std::size_t stitches = 0, n;
+    do
+    {
+        while ((n = decoder.next_stitches(run, 256, thePes)) > 0)
+            stitches += n;
+        r = decoder.next(s);
+        if (r == pec_decoder::stitch_record)
+        {
+            update_bounds(thePes, s);
+            stitches++;
+        }
+    } while (r != pec_decoder::end);
+    if (stitch_count)
+        *stitch_count = stitches;
+    return thePes;
+}
+
+pec_decoder pec_stitches(byte_span pesBin)
+{
+    return pec_stitches(pesBin, pec_offset(pesBin));
+}
+
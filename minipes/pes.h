@@ -2,7 +2,10 @@
 #define PES_H
 
 #include <vector>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <iterator>
 #include <limits>
 
 struct color {
@@ -10,13 +13,92 @@ struct color {
 	const unsigned char r,g,b;
 };
 
+/* What a stitch record is, from the flags of its long form coordinates.
+ * The needle stops for jumps and trims alike, so past the decoder they are
+ * only told apart from normal stitches (jumpstitch != 0). */
+enum stitch_type {
+	normal_stitch,
+	jump_stitch,
+	trim_stitch,
+};
+
 struct stitch {
-	int x{}, y{}, jumpstitch{}, speed{};
+	int x{}, y{}, jumpstitch{}, speed{};	// jumpstitch holds a stitch_type
+};
+
+/* The stitches of a block, stored as separate arrays: 16-bit x and y,
+ * a bitset of jump flags and 16-bit speeds, 6 bytes per stitch instead of
+ * the 16 of a struct stitch. Stitches are read and written as a whole
+ * through `stitch` values, single fields through the accessors. */
+class stitch_list
+{
+public:
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = stitch;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = stitch;
+
+		const_iterator(const stitch_list *list, std::size_t idx) : list_(list), idx_(idx) {}
+
+		stitch operator*() const { return (*list_)[idx_]; }
+		const_iterator &operator++() { ++idx_; return *this; }
+		const_iterator operator++(int) { auto it = *this; ++idx_; return it; }
+		bool operator==(const const_iterator &other) const { return idx_ == other.idx_; }
+		bool operator!=(const const_iterator &other) const { return idx_ != other.idx_; }
+
+	private:
+		const stitch_list *list_;
+		std::size_t idx_;
+	};
+
+	std::size_t size() const { return x_.size(); }
+	bool empty() const { return x_.empty(); }
+	void reserve(std::size_t n);
+
+	/* Throws if the position does not fit into 16 bits */
+	void push_back(const stitch &s);
+	void append(const stitch *s, std::size_t n);
+
+	stitch operator[](std::size_t i) const { return {x_[i], y_[i], jump(i), speed_[i]}; }
+	stitch back() const { return (*this)[size() - 1]; }
+	const_iterator begin() const { return {this, 0}; }
+	const_iterator end() const { return {this, size()}; }
+
+	int x(std::size_t i) const { return x_[i]; }
+	int y(std::size_t i) const { return y_[i]; }
+	int jump(std::size_t i) const { return (jumps_[i / 64] >> (i % 64)) & 1; }
+	int speed(std::size_t i) const { return speed_[i]; }
+
+	void set_jump(std::size_t i, bool jump)
+	{
+		if (jump)
+			jumps_[i / 64] |= std::uint64_t(1) << (i % 64);
+		else
+			jumps_[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+	}
+	void set_speed(std::size_t i, int speed) { speed_[i] = std::uint16_t(speed); }
+
+	/* The arrays as a whole, jump_words holds the flag of stitch i in bit
+	 * i % 64 of word i / 64 */
+	const std::int16_t *xs() const { return x_.data(); }
+	const std::int16_t *ys() const { return y_.data(); }
+	const std::uint64_t *jump_words() const { return jumps_.data(); }
+	const std::uint16_t *speeds() const { return speed_.data(); }
+	void assign(const std::int16_t *x, const std::int16_t *y, const std::uint64_t *jumps, const std::uint16_t *speed, std::size_t n);
+
+private:
+	std::vector<std::int16_t> x_, y_;
+	std::vector<std::uint64_t> jumps_;
+	std::vector<std::uint16_t> speed_;
 };
 
 struct pes_block {
 	color &block_color;
-	std::vector<stitch> stitches;
+	stitch_list stitches;
 };
 
 struct pes {
@@ -25,8 +107,81 @@ struct pes {
 	std::vector<pes_block> blocks;
 };
 
+/* Read-only view of the bytes of a file */
+struct byte_span {
+	const unsigned char *data{};
+	std::size_t size{};
+
+	byte_span() = default;
+	byte_span(const unsigned char *data, std::size_t size) : data(data), size(size) {}
+	byte_span(const std::vector<unsigned char>& v) : data(v.data()), size(v.size()) {}
+};
+
+/* A file mapped read-only into memory, for reading it front to back.
+ * The pages are only read when they are touched, if the file is truncated
+ * in the meantime touching the lost ones raises SIGBUS. Copy the bytes
+ * when they are read over a long time. */
+class mapped_file
+{
+public:
+	explicit mapped_file(const std::filesystem::path& path);
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	byte_span bytes() const { return {data_, size_}; }
+	operator byte_span() const { return bytes(); }
+
+private:
+	const unsigned char *data_{};
+	std::size_t size_{};
+#ifdef _WIN32
+	std::vector<unsigned char> contents_;
+#endif
+};
+
+/* Decodes the PEC stitch stream one record at a time.
+ * A record cut off by the end of the data ends the stream. */
+class pec_decoder
+{
+public:
+	enum result {
+		stitch_record,  // the next stitch, absolute coordinates
+		color_change,
+		end,
+	};
+
+	pec_decoder(const unsigned char *begin, const unsigned char *end) : p(begin), end_(end) {}
+
+	result next(stitch &s);
+
+	/* Decodes up to max stitches into out and widens the bounds of
+	 * `bounds` to include them. Stops in front of a color change or the
+	 * end, returns the number of stitches, 0 if next has to be called.
+	 * Runs of short records are decoded eight at a time with SSE2. */
+	std::size_t next_stitches(stitch *out, std::size_t max, pes &bounds);
+
+private:
+	std::size_t next_short_stitches(stitch *out, std::size_t max, pes &bounds);
+
+	const unsigned char *p, *end_;
+	int oldx{}, oldy{};
+};
+
+/* The colors of the PEC palette, by their index in the file */
+color& pes_color(unsigned char index);
+unsigned char pes_color_index(const color& c);
+
 /* Input */
-std::vector<unsigned char> read_file(const std::filesystem::path& path);
-pes parse_pes(const std::vector<unsigned char>& pesBin);
+pes parse_pes(byte_span pesBin);
+
+/* Colors and bounds of the design but no stitches, the bounds come from a
+ * pass over the stitch stream which does not store anything. The number
+ * of stitches goes to `stitch_count` unless it is null. */
+pes parse_pes_header(byte_span pesBin, std::size_t *stitch_count = nullptr);
+
+/* Decoder over the stitches, pesBin has to outlive it */
+pec_decoder pec_stitches(byte_span pesBin);
 
 #endif /* PES_H */
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "pes.h"
+
+namespace
+{
+
+std::vector<stitch> decode_one_by_one(const std::vector<unsigned char> &bytes)
+{
+    pec_decoder decoder(bytes.data(), bytes.data() + bytes.size());
+    std::vector<stitch> stitches;
+    stitch s;
+    pec_decoder::result r;
+    while ((r = decoder.next(s)) != pec_decoder::end)
+    {
+        if (r == pec_decoder::stitch_record)
+            stitches.push_back(s);
+    }
+    return stitches;
+}
+
+void short_record(std::vector<unsigned char> &out, int dx, int dy)
+{
+    out.push_back(dx & 0x7f);
+    out.push_back(dy & 0x7f);
+}
+
+void long_record(std::vector<unsigned char> &out, int dx, int dy, int x_flags, int y_flags)
+{
+    out.push_back(0x80 | x_flags | ((dx >> 8) & 15));
+    out.push_back(dx & 0xff);
+    out.push_back(0x80 | y_flags | ((dy >> 8) & 15));
+    out.push_back(dy & 0xff);
+}
+
+} // namespace
+
+// 0x10 marks a jump, 0x20 a trim, long form records without them are long stitches.
+TEST(PecDecoderTests, longFormTypes)
+{
+    std::vector<unsigned char> bytes;
+    long_record(bytes, 1000, -2048, 0, 0);
+    long_record(bytes, -1000, 2047, 0x10, 0x10);
+    long_record(bytes, 5, 5, 0x20, 0x20);
+    long_record(bytes, 5, 5, 0, 0x10);
+    long_record(bytes, 5, 5, 0x10, 0x20);
+    short_record(bytes, -64, 63);
+    bytes.insert(bytes.end(), {0xff, 0x00});
+
+    auto stitches = decode_one_by_one(bytes);
+    ASSERT_EQ(6u, stitches.size());
+    const int xs[] = {1000, 0, 5, 10, 15, -49};
+    const int ys[] = {-2048, -1, 4, 9, 14, 77};
+    const int types[] = {normal_stitch, jump_stitch, trim_stitch, jump_stitch, trim_stitch, normal_stitch};
+    for (std::size_t i = 0; i < stitches.size(); i++)
+    {
+        EXPECT_EQ(xs[i], stitches[i].x) << "stitch " << i;
+        EXPECT_EQ(ys[i], stitches[i].y) << "stitch " << i;
+        EXPECT_EQ(types[i], stitches[i].jumpstitch) << "stitch " << i;
+    }
+}
+
+// Runs of short records go through the SSE2 path eight at a time where
+// it is built in, everything else one record at a time.
+TEST(PecDecoderTests, batchesMatchOneByOne)
+{
+    std::vector<unsigned char> bytes;
+    for (int i = 0; i < 37; i++)
+        short_record(bytes, i % 2 ? -64 : 63, i % 3 ? 17 - i : i - 40);
+    long_record(bytes, 2047, -300, 0, 0);
+    for (int i = 0; i < 9; i++)
+        short_record(bytes, -i, i);
+    long_record(bytes, -2048, 100, 0x10, 0);
+    long_record(bytes, 0, 0, 0x20, 0);
+    for (int i = 0; i < 20; i++)
+        short_record(bytes, 3, -5);
+    bytes.insert(bytes.end(), {0xff, 0x00});
+    auto expected = decode_one_by_one(bytes);
+
+    for (std::size_t max : {1, 7, 8, 9, 256})
+    {
+        pec_decoder decoder(bytes.data(), bytes.data() + bytes.size());
+        std::vector<stitch> stitches, run(max);
+        pes bounds;
+        stitch s;
+        pec_decoder::result r{};
+        while (r != pec_decoder::end)
+        {
+            auto n = decoder.next_stitches(run.data(), max, bounds);
+            stitches.insert(stitches.end(), run.begin(), run.begin() + n);
+            if (n == 0 && (r = decoder.next(s)) == pec_decoder::stitch_record)
+            {
+                stitches.push_back(s);
+                bounds.min_x = std::min(bounds.min_x, s.x);
+                bounds.max_x = std::max(bounds.max_x, s.x);
+                bounds.min_y = std::min(bounds.min_y, s.y);
+                bounds.max_y = std::max(bounds.max_y, s.y);
+            }
+        }
+
+        ASSERT_EQ(expected.size(), stitches.size()) << "max " << max;
+        pes expected_bounds;
+        for (std::size_t i = 0; i < expected.size(); i++)
+        {
+            EXPECT_EQ(expected[i].x, stitches[i].x) << "max " << max << " stitch " << i;
+            EXPECT_EQ(expected[i].y, stitches[i].y) << "max " << max << " stitch " << i;
+            EXPECT_EQ(expected[i].jumpstitch, stitches[i].jumpstitch) << "max " << max << " stitch " << i;
+            expected_bounds.min_x = std::min(expected_bounds.min_x, expected[i].x);
+            expected_bounds.max_x = std::max(expected_bounds.max_x, expected[i].x);
+            expected_bounds.min_y = std::min(expected_bounds.min_y, expected[i].y);
+            expected_bounds.max_y = std::max(expected_bounds.max_y, expected[i].y);
+        }
+        EXPECT_EQ(expected_bounds.min_x, bounds.min_x) << "max " << max;
+        EXPECT_EQ(expected_bounds.max_x, bounds.max_x) << "max " << max;
+        EXPECT_EQ(expected_bounds.min_y, bounds.min_y) << "max " << max;
+        EXPECT_EQ(expected_bounds.max_y, bounds.max_y) << "max " << max;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Unhandled Exception: " << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -31,7 +31,8 @@
  * \section DESCRIPTION
  *
  * This provides a unix based pimpl for the Serial class. This implementation is
- * based off termios.h and uses select for multiplexing the IO ports.
+ * based off termios.h and uses epoll on Linux and select elsewhere for
+ * multiplexing the IO ports.
  *
  */
 
@@ -86,15 +87,27 @@ public:
   size_t
   available ();
 
+  size_t
+  outputQueued ();
+
   bool
   waitReadable (uint32_t timeout);
 
+  void
+  cancelWait ();
+
+  void
+  clearCancel ();
+
   void
   waitByteTimes (size_t count);
 
   size_t
   read (uint8_t *buf, size_t size = 1);
 
+  size_t
+  readSome (uint8_t *buf, size_t size);
+
   size_t
   write (const uint8_t *data, size_t length);
 
@@ -191,10 +204,22 @@ public:
 protected:
   void reconfigurePort ();
 
+  void openWaiters ();
+
+  void closeWaiters ();
+
 private:
   string port_;               // Path to the file descriptor
   int fd_;                    // The current file descriptor
 
+  int cancel_fd_;             // Readable after cancelWait, drained by waitReadable
+  int cancel_write_fd_;       // Written by cancelWait, cancel_fd_ itself on Linux
+#if defined(__linux__)
+  int read_epoll_fd_;         // Waits for fd_ or cancel_fd_ to become readable
+  int write_epoll_fd_;        // Waits for fd_ to become writable
+#endif
+  bool wait_cancelled_;       // The last waitReadable was woken by cancelWait
+
   bool is_open_;
   bool xonxoff_;
   bool rtscts_;
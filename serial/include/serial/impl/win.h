@@ -74,16 +74,28 @@ public:
 
   size_t
   available ();
+
+  size_t
+  outputQueued ();
   
   bool
   waitReadable (uint32_t timeout);
 
+  void
+  cancelWait ();
+
+  void
+  clearCancel ();
+
   void
   waitByteTimes (size_t count);
 
   size_t
   read (uint8_t *buf, size_t size = 1);
 
+  size_t
+  readSome (uint8_t *buf, size_t size);
+
   size_t
   write (const uint8_t *data, size_t length);
 
@@ -198,6 +210,8 @@ private:
   HANDLE read_mutex;
   // Mutex used to lock the write functions
   HANDLE write_mutex;
+  // Set by cancelWait, polled by waitReadable
+  HANDLE cancel_event_;
 };
 
 }
@@ -219,6 +219,11 @@ public:
   size_t
   available ();
 
+  /*! Return the number of characters written but not yet transmitted,
+   * i.e. still waiting in the output queue of the driver. */
+  size_t
+  outputQueued ();
+
   /*! Block until there is serial data to read or read_timeout_constant
    * number of milliseconds have elapsed. The return value is true when
    * the function exits with the port in a readable state, false otherwise
@@ -226,6 +231,36 @@ public:
   bool
   waitReadable ();
 
+  /*! Block until there is serial data to read or timeout number of
+   * milliseconds have elapsed. Unlike waitReadable () the configured
+   * serial::Timeout is ignored, which lets callers wait against their own
+   * deadline. The return value is true when the function exits with the
+   * port in a readable state, false otherwise (due to timeout, select
+   * interruption or cancelWait). */
+  bool
+  waitReadable (uint32_t timeout);
+
+  /*! Wake up a waitReadable or read blocked in another thread, it returns
+   * as if its timeout had elapsed, read with what it has read so far. A
+   * cancel made while nobody waits is kept for the next wait. On Windows
+   * only waitReadable is woken up, it polls the port every millisecond
+   * there.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::IOException
+   */
+  void
+  cancelWait ();
+
+  /*! Drop a cancelWait that no wait has used up yet. Call it once the
+   * thread that was cancelled stopped waiting, before the port is waited
+   * on again.
+   *
+   * \throw serial::PortNotOpenedException
+   */
+  void
+  clearCancel ();
+
   /*! Block for a period of time corresponding to the transmission time of
    * count characters at present serial settings. This may be used in con-
    * junction with waitReadable to read larger blocks of data from the
@@ -307,7 +342,10 @@ public:
 
   /*! Reads in a line or until a given delimiter has been processed.
    *
-   * Reads from the serial port until a single line has been read.
+   * Reads from the serial port until a single line has been read. The port
+   * is read in bursts, bytes that arrive after the line are kept in a
+   * receive buffer that the next read, readline or readlines return first.
+   * Only flushInput and close drop them.
    *
    * \param buffer A std::string reference used to store the data.
    * \param size A maximum length of a line, defaults to 65536 (2^16)
@@ -660,9 +698,23 @@ private:
   class ScopedReadLock;
   class ScopedWriteLock;
 
+  // Bytes readline and readlines took from the port past the end of the
+  // line, they are returned before anything else is read.
+  std::vector<uint8_t> rx_buffer_;
+  size_t rx_begin_;           // First byte not returned yet
+  size_t rx_end_;             // End of the bytes read from the port
+
   // Read common function
   size_t
   read_ (uint8_t *buffer, size_t size);
+  // Reads what the port has into rx_buffer_, waiting for at least one byte
+  size_t
+  fillReceiveBuffer_ ();
+  // Length of the first line in rx_buffer_, eol included, or 0
+  size_t
+  findLine_ (const std::string &eol, size_t limit, size_t &scanned) const;
+  void
+  clearReceiveBuffer_ ();
   // Write common function
   size_t
   write_ (const uint8_t *data, size_t length);
@@ -7,6 +7,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <algorithm>
 #include <sstream>
 #include <unistd.h>
 #include <fcntl.h>
@@ -21,6 +23,8 @@
 
 #if defined(__linux__)
 # include <linux/serial.h>
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
 #endif
 
 #include <sys/select.h>
@@ -105,11 +109,35 @@ timespec_from_ms (const uint32_t millis)
   return time;
 }
 
+#if defined(__linux__)
+// epoll_wait takes an int of milliseconds instead of a timespec, longer
+// waits are cut to the longest it accepts.
+static int
+epoll_timeout_ms (const timespec &time)
+{
+  int64_t millis = static_cast<int64_t> (time.tv_sec) * 1000 + time.tv_nsec / 1000000;
+  return static_cast<int> (std::min<int64_t> (millis, INT_MAX));
+}
+
+static int
+epoll_add (int epoll_fd, int fd, uint32_t events)
+{
+  epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+  return epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+#endif
+
 Serial::SerialImpl::SerialImpl (const string &port, unsigned long baudrate,
                                 bytesize_t bytesize,
                                 parity_t parity, stopbits_t stopbits,
                                 flowcontrol_t flowcontrol)
-  : port_ (port), fd_ (-1), is_open_ (false), xonxoff_ (false), rtscts_ (false),
+  : port_ (port), fd_ (-1), cancel_fd_ (-1), cancel_write_fd_ (-1),
+#if defined(__linux__)
+    read_epoll_fd_ (-1), write_epoll_fd_ (-1),
+#endif
+    wait_cancelled_ (false), is_open_ (false), xonxoff_ (false), rtscts_ (false),
     baudrate_ (baudrate), parity_ (parity),
     bytesize_ (bytesize), stopbits_ (stopbits), flowcontrol_ (flowcontrol)
 {
@@ -153,9 +181,66 @@ Serial::SerialImpl::open ()
   }
 
   reconfigurePort();
+  try {
+    openWaiters();
+  } catch (...) {
+    ::close (fd_);
+    fd_ = -1;
+    throw;
+  }
   is_open_ = true;
 }
 
+void
+Serial::SerialImpl::openWaiters ()
+{
+  // The descriptors are registered once here, waiting for the port
+  // afterwards is a single epoll_wait per call.
+#if defined(__linux__)
+  cancel_fd_ = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  cancel_write_fd_ = cancel_fd_;
+  read_epoll_fd_ = epoll_create1 (EPOLL_CLOEXEC);
+  write_epoll_fd_ = epoll_create1 (EPOLL_CLOEXEC);
+  bool ok = cancel_fd_ != -1 && read_epoll_fd_ != -1 && write_epoll_fd_ != -1
+            && epoll_add (read_epoll_fd_, fd_, EPOLLIN) == 0
+            && epoll_add (read_epoll_fd_, cancel_fd_, EPOLLIN) == 0
+            && epoll_add (write_epoll_fd_, fd_, EPOLLOUT) == 0;
+#else
+  int fds[2];
+  bool ok = pipe (fds) == 0;
+  if (ok) {
+    cancel_fd_ = fds[0];
+    cancel_write_fd_ = fds[1];
+    for (int i = 0; i < 2; i++) {
+      ok = ok && fcntl (fds[i], F_SETFL, O_NONBLOCK) == 0
+              && fcntl (fds[i], F_SETFD, FD_CLOEXEC) == 0;
+    }
+  }
+#endif
+  if (!ok) {
+    int error = errno;
+    closeWaiters ();
+    THROW (IOException, error);
+  }
+}
+
+void
+Serial::SerialImpl::closeWaiters ()
+{
+#if defined(__linux__)
+  int *fds[] = {&read_epoll_fd_, &write_epoll_fd_, &cancel_fd_};
+#else
+  int *fds[] = {&cancel_fd_, &cancel_write_fd_};
+#endif
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (*fds[i] != -1) {
+      ::close (*fds[i]);
+      *fds[i] = -1;
+    }
+  }
+  cancel_write_fd_ = -1;
+}
+
 void
 Serial::SerialImpl::reconfigurePort ()
 {
@@ -458,6 +543,7 @@ void
 Serial::SerialImpl::close ()
 {
   if (is_open_ == true) {
+    closeWaiters ();
     if (fd_ != -1) {
       int ret;
       ret = ::close (fd_);
@@ -491,15 +577,38 @@ Serial::SerialImpl::available ()
   }
 }
 
+size_t
+Serial::SerialImpl::outputQueued ()
+{
+  if (!is_open_) {
+    return 0;
+  }
+  int count = 0;
+  if (-1 == ioctl (fd_, TIOCOUTQ, &count)) {
+      THROW (IOException, errno);
+  } else {
+      return static_cast<size_t> (count);
+  }
+}
+
 bool
 Serial::SerialImpl::waitReadable (uint32_t timeout)
 {
-  // Setup a select call to block for serial data or a timeout
+  wait_cancelled_ = false;
+  timespec timeout_ts (timespec_from_ms (timeout));
+#if defined(__linux__)
+  // Block in epoll for serial data, a cancel or a timeout
+  epoll_event events[2];
+  int r = epoll_wait (read_epoll_fd_, events, 2, epoll_timeout_ms (timeout_ts));
+#else
+  // Setup a select call to block for serial data, a cancel or a timeout
   fd_set readfds;
   FD_ZERO (&readfds);
   FD_SET (fd_, &readfds);
-  timespec timeout_ts (timespec_from_ms (timeout));
-  int r = pselect (fd_ + 1, &readfds, NULL, NULL, &timeout_ts, NULL);
+  FD_SET (cancel_fd_, &readfds);
+  int r = pselect (std::max (fd_, cancel_fd_) + 1, &readfds, NULL, NULL,
+                   &timeout_ts, NULL);
+#endif
 
   if (r < 0) {
     // Select was interrupted
@@ -513,8 +622,27 @@ Serial::SerialImpl::waitReadable (uint32_t timeout)
   if (r == 0) {
     return false;
   }
+#if defined(__linux__)
+  bool readable = false, cancelled = false;
+  for (int i = 0; i < r; i++) {
+    if (events[i].data.fd == cancel_fd_) {
+      cancelled = true;
+    } else {
+      readable = true;
+    }
+  }
+#else
+  bool readable = FD_ISSET (fd_, &readfds);
+  bool cancelled = FD_ISSET (cancel_fd_, &readfds);
+#endif
+  // A cancel wins over data, the caller wants to stop waiting
+  if (cancelled) {
+    clearCancel ();
+    wait_cancelled_ = true;
+    return false;
+  }
   // This shouldn't happen, if r > 0 our fd has to be in the list!
-  if (!FD_ISSET (fd_, &readfds)) {
+  if (!readable) {
     THROW (IOException, "select reports ready to read, but our fd isn't"
            " in the list, this shouldn't happen!");
   }
@@ -522,6 +650,35 @@ Serial::SerialImpl::waitReadable (uint32_t timeout)
   return true;
 }
 
+void
+Serial::SerialImpl::cancelWait ()
+{
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::cancelWait");
+  }
+  uint64_t one = 1;
+#if defined(__linux__)
+  ssize_t r = ::write (cancel_write_fd_, &one, sizeof(one));
+#else
+  ssize_t r = ::write (cancel_write_fd_, &one, 1);
+#endif
+  // EAGAIN means a cancel is already pending
+  if (r < 0 && errno != EAGAIN) {
+    THROW (IOException, errno);
+  }
+}
+
+void
+Serial::SerialImpl::clearCancel ()
+{
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::clearCancel");
+  }
+  uint64_t drain[8];
+  while (::read (cancel_fd_, drain, sizeof(drain)) > 0) {
+  }
+}
+
 void
 Serial::SerialImpl::waitByteTimes (size_t count)
 {
@@ -601,18 +758,59 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
                                "read, this shouldn't happen, might be "
                                "a logical error!");
       }
+    } else if (wait_cancelled_) {
+      // Woken by cancelWait, return what was read so far
+      break;
     }
   }
   return bytes_read;
 }
 
+size_t
+Serial::SerialImpl::readSome (uint8_t *buf, size_t size)
+{
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::readSome");
+  }
+  // Take whatever the driver already has in one call
+  ssize_t bytes_read_now = ::read (fd_, buf, size);
+  if (bytes_read_now > 0) {
+    return static_cast<size_t> (bytes_read_now);
+  }
+
+  // Otherwise wait for the first byte as long as a one byte read would
+  long total_timeout_ms = timeout_.read_timeout_constant;
+  total_timeout_ms += timeout_.read_timeout_multiplier;
+  MillisecondTimer total_timeout(total_timeout_ms);
+  while (true) {
+    int64_t timeout_remaining_ms = total_timeout.remaining();
+    if (timeout_remaining_ms <= 0) {
+      return 0;
+    }
+    uint32_t timeout = std::min(static_cast<uint32_t> (timeout_remaining_ms),
+                                timeout_.inter_byte_timeout);
+    if (waitReadable(timeout)) {
+      bytes_read_now = ::read (fd_, buf, size);
+      if (bytes_read_now < 1) {
+        throw SerialException ("device reports readiness to read but "
+                               "returned no data (device disconnected?)");
+      }
+      return static_cast<size_t> (bytes_read_now);
+    } else if (wait_cancelled_) {
+      return 0;
+    }
+  }
+}
+
 size_t
 Serial::SerialImpl::write (const uint8_t *data, size_t length)
 {
   if (is_open_ == false) {
     throw PortNotOpenedException ("Serial::write");
   }
+#if !defined(__linux__)
   fd_set writefds;
+#endif
   size_t bytes_written = 0;
 
   // Calculate total timeout in milliseconds t_c + (t_m * N)
@@ -633,11 +831,19 @@ Serial::SerialImpl::write (const uint8_t *data, size_t length)
 
     timespec timeout(timespec_from_ms(timeout_remaining_ms));
 
+#if defined(__linux__)
+    // The port is the only descriptor of write_epoll_fd_
+    epoll_event event;
+    int r = epoll_wait (write_epoll_fd_, &event, 1, epoll_timeout_ms (timeout));
+    bool writable = r > 0;
+#else
     FD_ZERO (&writefds);
     FD_SET (fd_, &writefds);
 
     // Do the select
     int r = pselect (fd_ + 1, NULL, &writefds, NULL, &timeout, NULL);
+    bool writable = r > 0 && FD_ISSET (fd_, &writefds);
+#endif
 
     // Figure out what happened by looking at select's response 'r'
     /** Error **/
@@ -656,7 +862,7 @@ Serial::SerialImpl::write (const uint8_t *data, size_t length)
     /** Port ready to write **/
     if (r > 0) {
       // Make sure our file descriptor is in the ready to write list
-      if (FD_ISSET (fd_, &writefds)) {
+      if (writable) {
         // This will write some
         ssize_t bytes_written_now =
           ::write (fd_, data + bytes_written, length - bytes_written);
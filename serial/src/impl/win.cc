@@ -43,6 +43,8 @@ Serial::SerialImpl::SerialImpl (const string &port, unsigned long baudrate,
     open ();
   read_mutex = CreateMutex(NULL, false, NULL);
   write_mutex = CreateMutex(NULL, false, NULL);
+  // Manual reset, a cancel stays set until a wait uses it up
+  cancel_event_ = CreateEvent(NULL, true, false, NULL);
 }
 
 Serial::SerialImpl::~SerialImpl ()
@@ -50,6 +52,7 @@ Serial::SerialImpl::~SerialImpl ()
   this->close();
   CloseHandle(read_mutex);
   CloseHandle(write_mutex);
+  CloseHandle(cancel_event_);
 }
 
 void
@@ -314,17 +317,73 @@ Serial::SerialImpl::available ()
   return static_cast<size_t>(cs.cbInQue);
 }
 
+size_t
+Serial::SerialImpl::outputQueued ()
+{
+  if (!is_open_) {
+    return 0;
+  }
+  COMSTAT cs;
+  if (!ClearCommError(fd_, NULL, &cs)) {
+    stringstream ss;
+    ss << "Error while checking status of the serial port: " << GetLastError();
+    THROW (IOException, ss.str().c_str());
+  }
+  return static_cast<size_t>(cs.cbOutQue);
+}
+
 bool
-Serial::SerialImpl::waitReadable (uint32_t /*timeout*/)
+Serial::SerialImpl::waitReadable (uint32_t timeout)
+{
+  // The port is not opened for overlapped I/O, so Windows has no way to
+  // block until it is readable. The input queue is polled instead, the
+  // wait for the cancel event is the sleep between two polls (1 ms, or
+  // the timer resolution of the system if that is coarser).
+  ULONGLONG start = GetTickCount64 ();
+  while (true) {
+    if (available () > 0) {
+      return true;
+    }
+    if (WaitForSingleObject (cancel_event_, 1) == WAIT_OBJECT_0) {
+      ResetEvent (cancel_event_);
+      return false;
+    }
+    if (GetTickCount64 () - start >= timeout) {
+      return false;
+    }
+  }
+}
+
+void
+Serial::SerialImpl::cancelWait ()
+{
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::cancelWait");
+  }
+  if (!SetEvent (cancel_event_)) {
+    stringstream ss;
+    ss << "Error while cancelling a wait on the serial port: " << GetLastError();
+    THROW (IOException, ss.str().c_str());
+  }
+}
+
+void
+Serial::SerialImpl::clearCancel ()
 {
-  THROW (IOException, "waitReadable is not implemented on Windows.");
-  return false;
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::clearCancel");
+  }
+  ResetEvent (cancel_event_);
 }
 
 void
-Serial::SerialImpl::waitByteTimes (size_t /*count*/)
+Serial::SerialImpl::waitByteTimes (size_t count)
 {
-  THROW (IOException, "waitByteTimes is not implemented on Windows.");
+  // Start bit, data bits, parity bit and stop bits
+  double bits = 1 + bytesize_ + (parity_ != parity_none ? 1 : 0) +
+                (stopbits_ == stopbits_one_point_five ? 1.5 : stopbits_);
+  double ms = 1e3 * bits * count / baudrate_;
+  Sleep (static_cast<DWORD> (ms) + 1);
 }
 
 size_t
@@ -342,6 +401,24 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
   return (size_t) (bytes_read);
 }
 
+size_t
+Serial::SerialImpl::readSome (uint8_t *buf, size_t size)
+{
+  // Wait for the first byte like a one byte read, then take the rest of
+  // what the driver has
+  size_t bytes_read = read (buf, 1);
+  if (bytes_read == 1 && size > 1) {
+    size_t more = available ();
+    if (more > size - 1) {
+      more = size - 1;
+    }
+    if (more > 0) {
+      bytes_read += read (buf + 1, more);
+    }
+  }
+  return bytes_read;
+}
+
 size_t
 Serial::SerialImpl::write (const uint8_t *data, size_t length)
 {
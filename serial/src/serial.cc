@@ -1,14 +1,6 @@
 /* Copyright 2012 William Woodall and John Harrison */
 #include <algorithm>
 
-#if !defined(_WIN32) && !defined(__OpenBSD__) && !defined(__FreeBSD__)
-# include <alloca.h>
-#endif
-
-#if defined (__MINGW32__)
-# define alloca __builtin_alloca
-#endif
-
 #include "serial/serial.h"
 
 #ifdef _WIN32
@@ -67,7 +59,8 @@ Serial::Serial (const string &port, uint32_t baudrate, serial::Timeout timeout,
                 bytesize_t bytesize, parity_t parity, stopbits_t stopbits,
                 flowcontrol_t flowcontrol)
  : pimpl_(new SerialImpl (port, baudrate, bytesize, parity,
-                                           stopbits, flowcontrol))
+                                           stopbits, flowcontrol)),
+   rx_begin_(0), rx_end_(0)
 {
   pimpl_->setTimeout(timeout);
 }
@@ -87,6 +80,7 @@ void
 Serial::close ()
 {
   pimpl_->close ();
+  clearReceiveBuffer_ ();
 }
 
 bool
@@ -98,16 +92,46 @@ Serial::isOpen () const
 size_t
 Serial::available ()
 {
-  return pimpl_->available ();
+  return (rx_end_ - rx_begin_) + pimpl_->available ();
+}
+
+size_t
+Serial::outputQueued ()
+{
+  return pimpl_->outputQueued ();
 }
 
 bool
 Serial::waitReadable ()
 {
+  if (rx_begin_ != rx_end_) {
+    return true;
+  }
   serial::Timeout timeout(pimpl_->getTimeout ());
   return pimpl_->waitReadable(timeout.read_timeout_constant);
 }
 
+bool
+Serial::waitReadable (uint32_t timeout)
+{
+  if (rx_begin_ != rx_end_) {
+    return true;
+  }
+  return pimpl_->waitReadable(timeout);
+}
+
+void
+Serial::cancelWait ()
+{
+  pimpl_->cancelWait ();
+}
+
+void
+Serial::clearCancel ()
+{
+  pimpl_->clearCancel ();
+}
+
 void
 Serial::waitByteTimes (size_t count)
 {
@@ -117,14 +141,76 @@ Serial::waitByteTimes (size_t count)
 size_t
 Serial::read_ (uint8_t *buffer, size_t size)
 {
-  return this->pimpl_->read (buffer, size);
+  // Bytes readline took from the port come first
+  size_t buffered = min (size, rx_end_ - rx_begin_);
+  if (buffered > 0) {
+    memcpy (buffer, &rx_buffer_[rx_begin_], buffered);
+    rx_begin_ += buffered;
+    if (buffered == size) {
+      return size;
+    }
+  }
+  return buffered + this->pimpl_->read (buffer + buffered, size - buffered);
+}
+
+size_t
+Serial::fillReceiveBuffer_ ()
+{
+  // Move the bytes not returned yet to the front, so a line is always
+  // in one piece and the buffer only grows for long lines
+  if (rx_begin_ > 0) {
+    memmove (&rx_buffer_[0], &rx_buffer_[rx_begin_], rx_end_ - rx_begin_);
+    rx_end_ -= rx_begin_;
+    rx_begin_ = 0;
+  }
+  if (rx_end_ == rx_buffer_.size ()) {
+    rx_buffer_.resize (std::max<size_t> (4096, 2 * rx_buffer_.size ()));
+  }
+  size_t bytes_read = this->pimpl_->readSome (&rx_buffer_[rx_end_],
+                                              rx_buffer_.size () - rx_end_);
+  rx_end_ += bytes_read;
+  return bytes_read;
+}
+
+size_t
+Serial::findLine_ (const string &eol, size_t limit, size_t &scanned) const
+{
+  size_t eol_len = eol.length ();
+  if (eol_len == 0) {
+    return min<size_t> (limit, 1);
+  }
+  // The first `scanned` bytes were searched before, an eol may still end
+  // in the bytes added since
+  const uint8_t *begin = rx_buffer_.data () + rx_begin_;
+  const uint8_t *end = begin + limit;
+  const uint8_t *p = begin + (scanned >= eol_len ? scanned - eol_len + 1 : 0);
+  scanned = limit;
+  while (static_cast<size_t> (end - p) >= eol_len) {
+    p = static_cast<const uint8_t*>
+          (memchr (p, eol[0], (end - p) - eol_len + 1));
+    if (p == NULL) {
+      break;
+    }
+    if (memcmp (p, eol.data (), eol_len) == 0) {
+      return (p - begin) + eol_len;
+    }
+    ++p;
+  }
+  return 0;
+}
+
+void
+Serial::clearReceiveBuffer_ ()
+{
+  rx_begin_ = 0;
+  rx_end_ = 0;
 }
 
 size_t
 Serial::read (uint8_t *buffer, size_t size)
 {
   ScopedReadLock lock(this->pimpl_);
-  return this->pimpl_->read (buffer, size);
+  return this->read_ (buffer, size);
 }
 
 size_t
@@ -135,7 +221,7 @@ Serial::read (std::vector<uint8_t> &buffer, size_t size)
   size_t bytes_read = 0;
 
   try {
-    bytes_read = this->pimpl_->read (buffer_, size);
+    bytes_read = this->read_ (buffer_, size);
   }
   catch (const std::exception &e) {
     delete[] buffer_;
@@ -154,7 +240,7 @@ Serial::read (std::string &buffer, size_t size)
   uint8_t *buffer_ = new uint8_t[size];
   size_t bytes_read = 0;
   try {
-    bytes_read = this->pimpl_->read (buffer_, size);
+    bytes_read = this->read_ (buffer_, size);
   }
   catch (const std::exception &e) {
     delete[] buffer_;
@@ -177,27 +263,27 @@ size_t
 Serial::readline (string &buffer, size_t size, string eol)
 {
   ScopedReadLock lock(this->pimpl_);
-  size_t eol_len = eol.length ();
-  uint8_t *buffer_ = static_cast<uint8_t*>
-                              (alloca (size * sizeof (uint8_t)));
-  size_t read_so_far = 0;
+  size_t scanned = 0;
+  size_t line;
   while (true)
   {
-    size_t bytes_read = this->read_ (buffer_ + read_so_far, 1);
-    read_so_far += bytes_read;
-    if (bytes_read == 0) {
-      break; // Timeout occured on reading 1 byte
-    }
-    if (string (reinterpret_cast<const char*>
-         (buffer_ + read_so_far - eol_len), eol_len) == eol) {
+    size_t limit = min (size, rx_end_ - rx_begin_);
+    line = findLine_ (eol, limit, scanned);
+    if (line > 0) {
       break; // EOL found
     }
-    if (read_so_far == size) {
+    if (limit == size) {
+      line = size;
       break; // Reached the maximum read length
     }
+    if (fillReceiveBuffer_ () == 0) {
+      line = limit;
+      break; // Timeout occured on reading 1 byte
+    }
   }
-  buffer.append(reinterpret_cast<const char*> (buffer_), read_so_far);
-  return read_so_far;
+  buffer.append (reinterpret_cast<const char*> (rx_buffer_.data () + rx_begin_), line);
+  rx_begin_ += line;
+  return line;
 }
 
 string
@@ -213,37 +299,30 @@ Serial::readlines (size_t size, string eol)
 {
   ScopedReadLock lock(this->pimpl_);
   std::vector<std::string> lines;
-  size_t eol_len = eol.length ();
-  uint8_t *buffer_ = static_cast<uint8_t*>
-    (alloca (size * sizeof (uint8_t)));
   size_t read_so_far = 0;
-  size_t start_of_line = 0;
+  size_t scanned = 0;
   while (read_so_far < size) {
-    size_t bytes_read = this->read_ (buffer_+read_so_far, 1);
-    read_so_far += bytes_read;
-    if (bytes_read == 0) {
-      if (start_of_line != read_so_far) {
-        lines.push_back (
-          string (reinterpret_cast<const char*> (buffer_ + start_of_line),
-            read_so_far - start_of_line));
+    size_t limit = min (size - read_so_far, rx_end_ - rx_begin_);
+    size_t line = findLine_ (eol, limit, scanned);
+    bool last = false;
+    if (line == 0) {
+      if (limit < size - read_so_far && fillReceiveBuffer_ () > 0) {
+        continue;
       }
-      break; // Timeout occured on reading 1 byte
-    }
-    if (string (reinterpret_cast<const char*>
-         (buffer_ + read_so_far - eol_len), eol_len) == eol) {
-      // EOL found
-      lines.push_back(
-        string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-          read_so_far - start_of_line));
-      start_of_line = read_so_far;
-    }
-    if (read_so_far == size) {
-      if (start_of_line != read_so_far) {
-        lines.push_back(
-          string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-            read_so_far - start_of_line));
+      if (limit == 0) {
+        break; // Timeout occured on reading 1 byte
       }
-      break; // Reached the maximum read length
+      // Reached the maximum read length or timed out, the rest is a line too
+      line = limit;
+      last = true;
+    }
+    lines.push_back (
+      string (reinterpret_cast<const char*> (rx_buffer_.data () + rx_begin_), line));
+    rx_begin_ += line;
+    read_so_far += line;
+    scanned = 0;
+    if (last) {
+      break;
     }
   }
   return lines;
@@ -375,6 +454,7 @@ void Serial::flush ()
 void Serial::flushInput ()
 {
   ScopedReadLock lock(this->pimpl_);
+  clearReceiveBuffer_ ();
   pimpl_->flushInput ();
 }
 
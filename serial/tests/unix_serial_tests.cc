@@ -18,6 +18,10 @@ void loop()
 */
 
 #include <string>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <thread>
 #include "gtest/gtest.h"
 
 #include <boost/bind.hpp>
@@ -105,6 +109,103 @@ TEST_F(SerialTests, partialRead) {
   EXPECT_EQ(r, string("abc\n"));
 }
 
+TEST_F(SerialTests, readlineKeepsTheRest) {
+  write(master_fd, "abc\ndef\ngh", 10);
+  EXPECT_EQ(port1->readline(), string("abc\n"));
+  EXPECT_EQ(port1->available(), 6u);
+  EXPECT_EQ(port1->read(4), string("def\n"));
+
+  // Times out, returns what came without an EOL.
+  EXPECT_EQ(port1->readline(), string("gh"));
+}
+
+TEST_F(SerialTests, flushKeepsReceivedBytes) {
+  write(master_fd, "abc\ndef\n", 8);
+  EXPECT_EQ(port1->readline(), string("abc\n"));
+  // flush only drains the output, flushInput drops what was received
+  port1->flush();
+  EXPECT_EQ(port1->read(4), string("def\n"));
+  write(master_fd, "abc\ndef\n", 8);
+  EXPECT_EQ(port1->readline(), string("abc\n"));
+  port1->flushInput();
+  EXPECT_EQ(port1->available(), 0u);
+}
+
+TEST_F(SerialTests, readlineEolAcrossReads) {
+  write(master_fd, "abc\r", 4);
+  std::thread writer([this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    write(master_fd, "\ndef", 4);
+  });
+  EXPECT_EQ(port1->readline(65536, "\r\n"), string("abc\r\n"));
+  writer.join();
+  EXPECT_EQ(port1->readline(2), string("de"));
+}
+
+TEST_F(SerialTests, readlinesUntilTimeout) {
+  write(master_fd, "a\nbc\nd", 6);
+  std::vector<string> lines = port1->readlines();
+  ASSERT_EQ(lines.size(), 3u);
+  EXPECT_EQ(lines[0], string("a\n"));
+  EXPECT_EQ(lines[1], string("bc\n"));
+  EXPECT_EQ(lines[2], string("d"));
+}
+
+TEST_F(SerialTests, cancelWaitWakesReader) {
+  std::thread canceller([this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    port1->cancelWait();
+  });
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(port1->waitReadable(5000));
+  canceller.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+  // The cancel is used up, data wakes the next wait.
+  write(master_fd, "abc\n", 4);
+  EXPECT_TRUE(port1->waitReadable(250));
+}
+
+TEST_F(SerialTests, clearCancelAfterTheWaiterLeft) {
+  // Cancelled after the waiting thread returned on its own, like
+  // duplex_sender does when it stops
+  port1->cancelWait();
+  port1->clearCancel();
+
+  // The next wait times out as usual and sees data as usual
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(port1->waitReadable(100));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(90));
+  write(master_fd, "abc\n", 4);
+  EXPECT_EQ(port1->read(4), string("abc\n"));
+}
+
+#if defined(__linux__)
+TEST_F(SerialTests, openClosesThePortWhenTheWaitersFail) {
+  // Leave room for the port only, the eventfd then fails
+  int port_fd = dup(0);
+  close(port_fd);
+  rlimit old_limit;
+  getrlimit(RLIMIT_NOFILE, &old_limit);
+  rlimit limit = old_limit;
+  limit.rlim_cur = port_fd + 1;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  EXPECT_THROW(Serial(string(name), 115200), IOException);
+  setrlimit(RLIMIT_NOFILE, &old_limit);
+  EXPECT_EQ(fcntl(port_fd, F_GETFD), -1);
+}
+#endif
+
+TEST_F(SerialTests, cancelWaitEndsRead) {
+  write(master_fd, "ab", 2);
+  port1->cancelWait();
+  port1->setTimeout(Timeout::max(), 5000, 0, 5000, 0);
+
+  // Returns what was in the buffer without waiting for the rest.
+  string r = port1->read(4);
+  EXPECT_EQ(r, string("ab"));
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {